@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+
+// Number of global operator new calls so far, 0 unless RAST_COUNT_ALLOCS
+inline std::atomic<size_t>& alloc_counter()
+{
+	static std::atomic<size_t> count(0);
+	return count;
+}
+
+inline size_t alloc_count()
+{
+	return alloc_counter().load(std::memory_order_relaxed);
+}
+
+#ifdef RAST_COUNT_ALLOCS
+
+// gcc pairs the inlined malloc with delete's free and warns about it
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+
+// Replacement operators: include this from a single translation unit
+void* operator new(size_t size)
+{
+	alloc_counter().fetch_add(1, std::memory_order_relaxed);
+	
+	if (void* p = malloc(size ? size : 1))
+		return p;
+	
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, std::align_val_t align)
+{
+	alloc_counter().fetch_add(1, std::memory_order_relaxed);
+	
+	const size_t a = static_cast<size_t>(align);
+	
+	if (void* p = aligned_alloc(a, (size + a - 1) / a * a))
+		return p;
+	
+	throw std::bad_alloc();
+}
+
+void* operator new[](size_t size, std::align_val_t align)
+{
+	return operator new(size, align);
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
+
+#endif
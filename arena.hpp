@@ -0,0 +1,206 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+using namespace std;
+
+/*
+ * Linear allocator for data that lives for one frame. Allocation bumps an
+ * offset, reset() rewinds it in O(1); nothing is freed individually. If a
+ * frame spilled into more than one block, the next reset merges them into
+ * one block of the high-water size, so a steady frame loop stops calling
+ * malloc after the first frames.
+ */
+class FrameArena
+{
+private:
+	struct block {
+		unique_ptr<char[]> data;
+		size_t size;
+	};
+
+	vector<block> blocks;
+	size_t current;
+	size_t offset;
+	size_t before;		// bytes consumed in the blocks before current
+	size_t peak;
+	size_t blocksize;
+
+public:
+	FrameArena(size_t blocksize = 1 << 20) :
+		current(0), offset(0), before(0), peak(0), blocksize(blocksize)
+	{
+	}
+
+	inline void* allocate(size_t bytes, size_t align = alignof(max_align_t))
+	{
+		while (true) {
+			if (current < blocks.size()) {
+				block& b = blocks[current];
+
+				const uintptr_t base = reinterpret_cast<uintptr_t>(b.data.get());
+				const size_t start = ((base + offset + align - 1) & ~(align - 1)) - base;
+
+				if (start + bytes <= b.size) {
+					offset = start + bytes;
+					peak = max(peak, before + offset);
+					return b.data.get() + start;
+				}
+
+				before += offset;
+				offset = 0;
+				++current;
+				continue;
+			}
+
+			const size_t size = max(blocksize, bytes + align);
+			blocks.push_back({unique_ptr<char[]>(new char[size]), size});
+		}
+	}
+
+	template<typename T>
+	inline T* allocate(size_t count)
+	{
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+	}
+
+	inline void reset()
+	{
+		if (blocks.size() > 1) {
+			blocksize = max(blocksize, peak + alignof(max_align_t));
+			blocks.clear();
+		}
+
+		current = 0;
+		offset = 0;
+		before = 0;
+	}
+
+	inline size_t used() const
+	{
+		return before + offset;
+	}
+
+	inline size_t high_water() const
+	{
+		return peak;
+	}
+
+	inline size_t capacity() const
+	{
+		size_t retval = 0;
+		for (const block& b: blocks)
+			retval += b.size;
+		return retval;
+	}
+};
+
+/*
+ * One FrameArena per thread that touches it, created on first use. The
+ * arenas are reset together by whoever owns the frame, once no thread
+ * is allocating any more.
+ */
+class ArenaSet
+{
+private:
+	struct Cache {
+		uint64_t owner;
+		FrameArena* arena;
+	};
+
+	struct Entry {
+		thread::id owner;
+		FrameArena arena;
+	};
+
+	static inline Cache& cache()
+	{
+		static thread_local Cache c = {0, nullptr};
+		return c;
+	}
+
+	static inline uint64_t next_id()
+	{
+		static atomic<uint64_t> id(0);
+		return ++id;
+	}
+
+	const uint64_t id;
+
+	mutex lock;
+	deque<Entry> arenas;
+	size_t blocksize;
+
+public:
+	ArenaSet(size_t blocksize = 1 << 20) : id(next_id()), blocksize(blocksize)
+	{
+	}
+
+	ArenaSet(const ArenaSet&) = delete;
+
+	inline FrameArena& local()
+	{
+		Cache& c = cache();
+
+		if (c.owner != id) {
+			lock_guard<mutex> guard(lock);
+
+			const thread::id self = this_thread::get_id();
+
+			auto it = find_if(arenas.begin(), arenas.end(),
+				[self] (const Entry& e) { return e.owner == self; });
+
+			if (it == arenas.end()) {
+				arenas.push_back({self, FrameArena(blocksize)});
+				it = arenas.end() - 1;
+			}
+
+			c = {id, &it->arena};
+		}
+
+		return *c.arena;
+	}
+
+	inline void reset()
+	{
+		for (Entry& e: arenas)
+			e.arena.reset();
+	}
+
+	inline size_t count() const
+	{
+		return arenas.size();
+	}
+
+	inline size_t used() const
+	{
+		size_t retval = 0;
+		for (const Entry& e: arenas)
+			retval += e.arena.used();
+		return retval;
+	}
+
+	inline size_t high_water() const
+	{
+		size_t retval = 0;
+		for (const Entry& e: arenas)
+			retval += e.arena.high_water();
+		return retval;
+	}
+
+	inline size_t capacity() const
+	{
+		size_t retval = 0;
+		for (const Entry& e: arenas)
+			retval += e.arena.capacity();
+		return retval;
+	}
+};
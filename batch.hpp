@@ -0,0 +1,249 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <stdexcept>
+#include <cstdio>
+#include <cmath>
+
+#include "pipeline.hpp"
+#include "framebuffer.hpp"
+#include "fbwriter.hpp"
+#include "shaders.hpp"
+#include "jobs.hpp"
+#include "wfobj.hpp"
+
+using namespace std;
+
+// Camera looking from eye at target
+struct View
+{
+	vec3f eye;
+	vec3f target;
+	vec3f up;
+};
+
+// Bounding sphere of the mesh, to place turntable cameras and clip planes
+struct Bounds
+{
+	vec3f center;
+	float radius;
+};
+
+inline Bounds mesh_bounds(const Mesh& mesh)
+{
+	if (mesh.verts.empty())
+		return {{0.f, 0.f, 0.f}, 1.f};
+
+	vec3f lo = mesh.verts[0].pos;
+	vec3f hi = lo;
+
+	for (const Mesh::vertex& v: mesh.verts)
+		for (int k = 0; k < 3; ++k) {
+			lo[k] = min(lo[k], v.pos[k]);
+			hi[k] = max(hi[k], v.pos[k]);
+		}
+
+	return {(lo + hi) * 0.5f, max(0.5f * (hi - lo).length(), 1e-3f)};
+}
+
+/*
+ * count views on a circle around the y axis through the center, elevation
+ * in radians, distance in bounding radii; at 1.5 the whole bounding sphere
+ * fits the projection's 90 degree field of view
+ */
+inline vector<View> turntable(const Bounds& b, unsigned count,
+								float elevation = 0.3f, float distance = 1.5f)
+{
+	vector<View> views;
+
+	for (unsigned i = 0; i < count; ++i) {
+		const float phi = 2.f * M_PI * i / count;
+
+		const vec3f dir = {
+			cosf(elevation) * sinf(phi),
+			sinf(elevation),
+			cosf(elevation) * cosf(phi)
+		};
+
+		views.push_back({b.center + dir * (distance * b.radius), b.center, {0.f, 1.f, 0.f}});
+	}
+
+	return views;
+}
+
+// One view per line: eye x y z, target x y z, optionally up x y z
+inline vector<View> read_poses(const char* filename)
+{
+	ifstream in(filename);
+	if (!in.is_open())
+		throw invalid_argument("can not find file " + string(filename));
+
+	vector<View> views;
+	string line;
+
+	while (getline(in, line)) {
+		istringstream fields(line);
+
+		View v = {{}, {}, {0.f, 1.f, 0.f}};
+
+		if (!(fields >> v.eye.x >> v.eye.y >> v.eye.z
+					>> v.target.x >> v.target.y >> v.target.z))
+			continue;
+
+		fields >> v.up.x >> v.up.y >> v.up.z;
+
+		views.push_back(v);
+	}
+
+	return views;
+}
+
+/*
+ * Renders every view of one shared, read-only mesh into its own file
+ * prefix0000.rgba, prefix0001.rgba, ... through FBWriter. Each worker
+ * slot owns a pipeline, a color buffer and a writer and keeps taking the
+ * next view until none are left. Views whose file can not be written are
+ * counted as failed.
+ */
+class BatchRenderer
+{
+public:
+	struct stats {
+		size_t views;
+		size_t failed;
+		double seconds;
+		size_t workers;
+		size_t worker_bytes;
+	};
+
+	bgracolor_t background = {0, 0, 0, 255};
+
+private:
+	struct Worker {
+		Pipeline<LambertShader> pipe;
+		Framebuffer color;
+		FBWriter writer;
+
+		Worker(const LambertShader& shader, int w, int h) :
+			pipe(shader), color(w, h),
+			writer({static_cast<uint16_t>(w), static_cast<uint16_t>(h)})
+		{
+			pipe.set_view(w, h);
+		}
+
+		inline size_t memory_usage() const
+		{
+			return pipe.memory_usage() + color.memory_usage()
+				+ writer.resolution.w * writer.resolution.h * sizeof(rgbacolor_t);
+		}
+	};
+
+	int w, h;
+	Bounds bounds;
+	JobSystem* jobs;
+
+	vector<unique_ptr<Worker>> workers;
+
+	inline void setup_camera(Camera& cam, const View& v) const
+	{
+		const vec3f dir = (v.eye - v.target).normalized();
+		const float dist = (v.eye - bounds.center).length();
+
+		// looking along up has no roll; any other axis will do
+		const vec3f up = cross(v.up, dir).length2() > 1e-6f ? v.up :
+						fabsf(dir.x) < 0.9f ? vec3f{1.f, 0.f, 0.f} : vec3f{0.f, 1.f, 0.f};
+
+		// rotate() puts its second axis into row 0, screen x; up belongs in row 1
+		cam.rotater = rotate(dir, cross(dir, up));
+		cam.campos = v.eye;
+		cam.move = {0.f, 0.f, 0.f};
+
+		const float near = max(dist - 1.5f * bounds.radius, 1e-3f * bounds.radius);
+		cam.set_projection(static_cast<float>(w) / h, near, dist + 1.5f * bounds.radius);
+	}
+
+	template<typename Geometry>
+	inline bool render(const Geometry& mesh, const View& v, Worker& wk,
+						const string& prefix, size_t index)
+	{
+		setup_camera(wk.pipe.shader.cam, v);
+
+		wk.pipe.clear();
+		wk.color.clear(background);
+		wk.pipe.draw(mesh, wk.color);
+
+		// both are top row first, only the channel order differs
+		const bgracolor_t* src = wk.color.data();
+		rgbacolor_t* dst = wk.writer.data();
+
+		for (int i = 0; i < w * h; ++i)
+			dst[i] = {src[i].r, src[i].g, src[i].b, src[i].a};
+
+		wk.writer.open(filename(prefix, index).c_str());
+		if (!wk.writer.is_open())
+			return false;
+
+		wk.writer.flush();
+		wk.writer.close();
+
+		return true;
+	}
+
+public:
+	static inline string filename(const string& prefix, size_t index)
+	{
+		char number[24];
+		snprintf(number, sizeof(number), "%04zu", index);
+		return prefix + number + ".rgba";
+	}
+
+	BatchRenderer(const LambertShader& shader, const Bounds& bounds,
+					int width, int height, JobSystem* jobs = nullptr) :
+		w(width), h(height), bounds(bounds), jobs(jobs)
+	{
+		const size_t count = jobs ? jobs->threads() + 1 : 1;
+
+		for (size_t i = 0; i < count; ++i)
+			workers.emplace_back(new Worker(shader, w, h));
+	}
+
+	template<typename Geometry>
+	inline stats run(const Geometry& mesh, const vector<View>& views, const string& prefix)
+	{
+		const auto start = chrono::steady_clock::now();
+
+		atomic<size_t> next(0);
+		atomic<size_t> failed(0);
+
+		auto const work = [&] (size_t first, size_t last)
+		{
+			for (size_t slot = first; slot < last; ++slot)
+				for (size_t v; (v = next++) < views.size(); )
+					if (!render(mesh, views[v], *workers[slot], prefix, v))
+						++failed;
+		};
+
+		if (jobs)
+			jobs->parallel_for(0, workers.size(), 1, work);
+		else
+			work(0, workers.size());
+
+		size_t bytes = 0;
+		for (const auto& wk: workers)
+			bytes = max(bytes, wk->memory_usage());
+
+		return {
+			views.size(),
+			failed.load(),
+			chrono::duration<double>(chrono::steady_clock::now() - start).count(),
+			workers.size(),
+			bytes
+		};
+	}
+};
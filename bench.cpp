@@ -0,0 +1,1174 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+
+#include "pipeline.hpp"
+#include "framepipe.hpp"
+#include "framebuffer.hpp"
+#include "lines.hpp"
+#include "packed.hpp"
+#include "dynres.hpp"
+#include "batch.hpp"
+#include "temporal.hpp"
+#include "stream.hpp"
+#include "shadow.hpp"
+#include "tiled.hpp"
+#include "perfcount.hpp"
+#include "arena.hpp"
+#include "allochook.hpp"
+#include "shaders.hpp"
+#include "wfobj.hpp"
+
+using bench_clock = chrono::steady_clock;
+
+static double seconds_since(bench_clock::time_point start)
+{
+	return chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static Mesh make_sphere(int rings, int segments, float radius)
+{
+	Mesh mesh;
+
+	for (int i = 0; i <= rings; ++i)
+		for (int j = 0; j <= segments; ++j) {
+			const float theta = M_PI * i / rings;
+			const float phi = 2.f * M_PI * j / segments;
+
+			const vec3f n = {sinf(theta) * cosf(phi), cosf(theta), sinf(theta) * sinf(phi)};
+			const vec2f t = {static_cast<float>(j) / segments, static_cast<float>(i) / rings};
+
+			mesh.verts.push_back({n * radius, t, n});
+		}
+
+	for (int i = 0; i < rings; ++i)
+		for (int j = 0; j < segments; ++j) {
+			const Mesh::uint a = i * (segments + 1) + j;
+			const Mesh::uint b = a + segments + 1;
+
+			for (Mesh::uint k: {a, a + 1, b + 1, a, b + 1, b})
+				mesh.inds.push_back(k);
+		}
+
+	return mesh;
+}
+
+// Large axis-aligned quads stacked along z, the case plane tiles are for
+static Mesh make_walls(int count, float size)
+{
+	Mesh mesh;
+
+	for (int i = 0; i < count; ++i) {
+		const float z = -size * 0.5f + i * size / count;
+		const Mesh::uint base = mesh.verts.size();
+
+		for (int k = 0; k < 4; ++k) {
+			const vec3f p = {k & 1 ? size : -size, k & 2 ? size : -size, z};
+			mesh.verts.push_back({p, {}, {0.f, 0.f, 1.f}});
+		}
+
+		for (Mesh::uint k: {0u, 1u, 3u, 0u, 3u, 2u})
+			mesh.inds.push_back(base + k);
+	}
+
+	return mesh;
+}
+
+// Axis-aligned box, four vertices per face for flat normals
+static Mesh make_box(const vec3f& lo, const vec3f& hi)
+{
+	Mesh mesh;
+
+	for (int axis = 0; axis < 3; ++axis)
+		for (int side = 0; side < 2; ++side) {
+			const int u = (axis + 1) % 3;
+			const int v = (axis + 2) % 3;
+			const Mesh::uint base = mesh.verts.size();
+
+			vec3f n = {0.f, 0.f, 0.f};
+			n[axis] = side ? 1.f : -1.f;
+
+			for (int k = 0; k < 4; ++k) {
+				vec3f p;
+				p[axis] = side ? hi[axis] : lo[axis];
+				p[u] = k & 1 ? hi[u] : lo[u];
+				p[v] = k & 2 ? hi[v] : lo[v];
+				mesh.verts.push_back({p, {}, n});
+			}
+
+			for (Mesh::uint k: {0u, 1u, 3u, 0u, 3u, 2u})
+				mesh.inds.push_back(base + k);
+		}
+
+	return mesh;
+}
+
+static void setup_camera(Camera& cam, int w, int h, float distance)
+{
+	const vec3f dir = (vec3f{0.3f, 0.2f, 1.f}).normalized();
+
+	cam.move = {0.f, 0.f, 0.f};
+	cam.rotater = rotate(dir, {0.f, 0.f, 1.f});
+	cam.campos = dir * distance;
+	cam.set_projection(static_cast<float>(w) / h, 0.5f, 25.f);
+}
+
+template<DepthFormat F>
+static void bench_depth(const char* scene, const Mesh& mesh, float distance, int w, int h)
+{
+	using traits = DepthTraits<F>;
+
+	const int frames = 20;
+
+	// raw per-pixel test throughput, front to back in four layers
+	DepthBuffer<F> depth;
+	depth.resize(w, h);
+
+	size_t passed = 0;
+	auto start = bench_clock::now();
+
+	for (int f = 0; f < frames; ++f) {
+		depth.clear();
+		for (int layer = 0; layer < 4; ++layer) {
+			const float z = 0.9f - 0.3f * (layer & 1);
+			for (int y = 0; y < h; ++y)
+				for (int x = 0; x < w; ++x)
+					passed += depth.test(x, y, z);
+		}
+	}
+
+	const double raw = seconds_since(start);
+
+	// past the far plane must fail, not wrap around in the unorm formats
+	depth.clear();
+	const bool far = !depth.test(0, 0, 1.01f) && !depth.test(1, 0, 1.5f)
+						&& depth.test(2, 0, 0.99f);
+
+	// full frames through the pipeline
+	Pipeline<FlatShader, F> pipe;
+	pipe.set_view(w, h);
+	setup_camera(pipe.shader.cam, w, h, distance);
+	pipe.shader.color = {1.f, 1.f, 1.f};
+
+	Framebuffer fb(w, h);
+
+	start = bench_clock::now();
+
+	for (int f = 0; f < frames; ++f) {
+		pipe.clear();
+		pipe.draw(mesh, fb);
+	}
+
+	const double frame = seconds_since(start) / frames;
+
+	const DepthBuffer<F>& db = pipe.depth_buffer();
+
+	cout << setw(8) << scene << setw(12) << traits::name
+		<< setw(10) << db.memory_usage() / 1024 << " KiB"
+		<< setw(10) << fixed << setprecision(1)
+		<< 4.0 * frames * w * h / raw * 1e-6 << " Mtest/s"
+		<< setw(9) << setprecision(2) << frame * 1e3 << " ms/frame"
+		<< setw(8) << db.plane_tiles() << " plane"
+		<< setw(8) << db.expanded_tiles() << " expanded"
+		<< " / " << db.tile_count() << (passed ? "" : " !")
+		<< (far ? "" : " beyond far plane passes!") << endl;
+}
+
+template<DepthFormat F>
+static void bench_depth_all(int w, int h, const Mesh& sphere, const Mesh& walls)
+{
+	bench_depth<F>("sphere", sphere, 4.f, w, h);
+	bench_depth<F>("walls", walls, 6.f, w, h);
+}
+
+static void bench_frame_pipeline(const Mesh& mesh, int w, int h)
+{
+	const unsigned frames = 60;
+
+	LambertShader shader;
+	setup_camera(shader.cam, w, h, 4.f);
+	shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	shader.color = {0.5f, 0.2f, 1.f};
+
+	Framebuffer screen(w, h);
+	const size_t bytes = w * h * sizeof(bgracolor_t);
+
+	const auto update = [w, h] (unsigned i, LambertShader& s)
+	{
+		setup_camera(s.cam, w, h, 4.f + 0.01f * i);
+	};
+
+	const auto present = [&screen, bytes] (const Framebuffer& fb)
+	{
+		memcpy(screen.data(), fb.data(), bytes);
+	};
+
+	// everything on one thread, as the plain frame loop does
+	Pipeline<LambertShader> pipe(shader);
+	pipe.set_view(w, h);
+
+	Framebuffer color(w, h);
+
+	auto start = bench_clock::now();
+
+	for (unsigned i = 0; i < frames; ++i) {
+		update(i, pipe.shader);
+		pipe.clear();
+		color.clear();
+		pipe.draw(mesh, color);
+		present(color);
+	}
+
+	const double sequential = seconds_since(start);
+
+	cout << "frame pipeline, " << w << "x" << h << ", "
+		<< thread::hardware_concurrency() << " hardware threads" << endl;
+	cout << setw(12) << "sequential" << setw(10) << fixed << setprecision(1)
+		<< frames / sequential << " fps" << endl;
+
+	for (int depth: {1, 2, 3, 4}) {
+		FramePipeline<LambertShader> fp(mesh, shader, w, h, depth);
+
+		auto const stats = fp.run(frames, update, present);
+
+		cout << setw(10) << "depth " << depth << setw(10) << fixed << setprecision(1)
+			<< stats.frames / stats.seconds << " fps"
+			<< setprecision(2)
+			<< "  geometry " << 1e3 * stats.geometry / stats.frames
+			<< "  raster " << 1e3 * stats.raster / stats.frames
+			<< "  present " << 1e3 * stats.present / stats.frames
+			<< " ms/frame" << endl;
+	}
+}
+
+static void write_obj(const Mesh& mesh, const char* filename)
+{
+	ofstream out(filename);
+
+	for (const Mesh::vertex& v: mesh.verts)
+		out << "v " << v.pos.x << " " << v.pos.y << " " << v.pos.z << "\n"
+			<< "vt " << v.tex.x << " " << v.tex.y << "\n"
+			<< "vn " << v.norm.x << " " << v.norm.y << " " << v.norm.z << "\n";
+
+	for (size_t i = 0; i + 2 < mesh.inds.size(); i += 3) {
+		out << "f";
+		for (int k = 0; k < 3; ++k)
+			out << " " << mesh.inds[i + k] + 1 << "/" << mesh.inds[i + k] + 1
+				<< "/" << mesh.inds[i + k] + 1;
+		out << "\n";
+	}
+}
+
+static void bench_jobs(const Mesh& mesh, int w, int h)
+{
+	const char* const path = "/tmp/rast_bench.obj";
+	write_obj(mesh, path);
+
+	JobSystem jobs;
+
+	cout << "job system, " << jobs.threads() << " worker threads" << endl;
+
+	auto start = bench_clock::now();
+	const Mesh serial = import_obj(path);
+	const double load_serial = seconds_since(start);
+
+	start = bench_clock::now();
+	const Mesh parallel = import_obj(path, &jobs);
+	const double load_parallel = seconds_since(start);
+
+	remove(path);
+
+	cout << setw(12) << "import_obj" << fixed << setprecision(2)
+		<< setw(10) << load_serial * 1e3 << " ms serial"
+		<< setw(10) << load_parallel * 1e3 << " ms parallel"
+		<< (serial.inds == parallel.inds ? "" : " (mismatch!)") << endl;
+
+	const int frames = 30;
+
+	Pipeline<LambertShader> pipe;
+	pipe.set_view(w, h);
+	setup_camera(pipe.shader.cam, w, h, 4.f);
+	pipe.shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	pipe.shader.color = {0.5f, 0.2f, 1.f};
+
+	Framebuffer fb(w, h);
+
+	for (JobSystem* js: {static_cast<JobSystem*>(nullptr), &jobs}) {
+		pipe.set_jobs(js);
+		jobs.reset_stats();
+
+		start = bench_clock::now();
+
+		for (int f = 0; f < frames; ++f) {
+			pipe.clear();
+			pipe.draw(mesh, fb);
+		}
+
+		cout << setw(12) << (js ? "with jobs" : "serial") << setw(10) << setprecision(2)
+			<< seconds_since(start) / frames * 1e3 << " ms/frame" << endl;
+	}
+
+	auto const stats = jobs.stats();
+
+	for (size_t i = 0; i < stats.size(); ++i)
+		cout << setw(12) << (i < jobs.threads() ? "worker " + to_string(i) : string("outside"))
+			<< setw(8) << stats[i].tasks << " tasks" << setw(8) << stats[i].steals
+			<< " steals" << setw(8) << setprecision(1) << 100. * stats[i].utilization
+			<< "% busy" << endl;
+}
+
+static void bench_lines(const Mesh& mesh, int w, int h)
+{
+	const size_t count = 1000000;
+
+	// a third of the segments poke out of the viewport and get clipped
+	mt19937 rng(42);
+	uniform_real_distribution<float> xs(-0.25f * w, 1.25f * w);
+	uniform_real_distribution<float> ys(-0.25f * h, 1.25f * h);
+	uniform_real_distribution<float> len(-40.f, 40.f);
+
+	vector<segment_t> segs(count);
+	for (segment_t& s: segs) {
+		s.dots[0] = {xs(rng), ys(rng)};
+		s.dots[1] = s.dots[0] + vec2f{len(rng), len(rng)};
+	}
+
+	Framebuffer fb(w, h);
+
+	auto start = bench_clock::now();
+	draw_segments(fb, segs.data(), segs.size(), {255u, 255u, 255u, 255u});
+	const double batch = seconds_since(start);
+
+	Camera cam;
+	setup_camera(cam, w, h, 4.f);
+
+	const auto project = [&cam] (const vec3f& pos) { return cam.project(pos); };
+
+	start = bench_clock::now();
+	Wireframe wf(mesh);
+	const double edges = seconds_since(start);
+
+	const int frames = 20;
+
+	start = bench_clock::now();
+	for (int f = 0; f < frames; ++f)
+		wf.draw(mesh, project, fb, {255u, 255u, 255u, 255u});
+	const double wire = seconds_since(start) / frames;
+
+	cout << "lines, " << w << "x" << h << endl;
+	cout << setw(12) << "batch" << fixed << setprecision(1)
+		<< setw(10) << count / batch * 1e-6 << " Mlines/s (40px, clipped)" << endl;
+	cout << setw(12) << "wireframe" << setw(10) << wf.edge_count() / wire * 1e-6
+		<< " Medges/s, " << wf.edge_count() << " edges of "
+		<< mesh.inds.size() / 3 << " triangles, dedup " << setprecision(2)
+		<< edges * 1e3 << " ms" << endl;
+}
+
+static void bench_packed(int w, int h)
+{
+	// big enough that vertex data does not fit in cache
+	const Mesh mesh = make_sphere(1000, 2000, 1.5f);
+
+	auto start = bench_clock::now();
+	const PackedMesh packed = pack_mesh(mesh);
+	const double pack = seconds_since(start);
+
+	const pack_error err = measure_error(mesh, packed);
+
+	// vertex streams only, the indices are the same 32-bit list in both
+	const size_t floats = mesh.verts.size() * sizeof(Mesh::vertex);
+	const size_t packs = packed.verts.size() * sizeof(PackedMesh::vertex);
+	const size_t indices = mesh.inds.size() * sizeof(Mesh::uint);
+
+	cout << "packed vertices, " << mesh.verts.size() << " vertices" << endl;
+	cout << setw(12) << "memory" << setw(10) << floats / 1024 / 1024 << " MiB float"
+		<< setw(10) << packs / 1024 / 1024 << " MiB packed, vertices "
+		<< sizeof(Mesh::vertex) << " -> " << sizeof(PackedMesh::vertex) << " bytes, "
+		<< indices / 1024 / 1024 << " MiB indices either way, pack "
+		<< fixed << setprecision(1) << pack * 1e3 << " ms" << endl;
+	cout << setw(12) << "error" << scientific << setprecision(2)
+		<< " pos " << err.pos << " (bound " << err.pos_bound << ")"
+		<< " norm " << err.norm << " deg tex " << err.tex << endl;
+
+	using pipeline = Pipeline<LambertShader>;
+
+	LambertShader shader;
+	setup_camera(shader.cam, w, h, 4.f);
+	shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	shader.color = {0.5f, 0.2f, 1.f};
+
+	vector<pipeline::vertex_out> out;
+	pipeline::transform(shader, mesh, out);
+
+	const int runs = 10;
+
+	start = bench_clock::now();
+	for (int r = 0; r < runs; ++r)
+		pipeline::transform(shader, mesh, out);
+	const double tfloat = seconds_since(start) / runs;
+
+	start = bench_clock::now();
+	for (int r = 0; r < runs; ++r)
+		pipeline::transform(shader, packed, out);
+	const double tpacked = seconds_since(start) / runs;
+
+	pipeline pipe(shader);
+	pipe.set_view(w, h);
+
+	Framebuffer fb(w, h);
+
+	start = bench_clock::now();
+	for (int r = 0; r < runs; ++r) {
+		pipe.clear();
+		pipe.draw(mesh, fb);
+	}
+	const double ffloat = seconds_since(start) / runs;
+
+	start = bench_clock::now();
+	for (int r = 0; r < runs; ++r) {
+		pipe.clear();
+		pipe.draw(packed, fb);
+	}
+	const double fpacked = seconds_since(start) / runs;
+
+	cout << setw(12) << "transform" << fixed << setprecision(1)
+		<< setw(10) << mesh.verts.size() / tfloat * 1e-6 << " Mvert/s float"
+		<< setw(10) << mesh.verts.size() / tpacked * 1e-6 << " Mvert/s packed" << endl;
+	cout << setw(12) << "frame" << setprecision(2)
+		<< setw(10) << ffloat * 1e3 << " ms float"
+		<< setw(10) << fpacked * 1e3 << " ms packed" << endl;
+}
+
+static void bench_dynres(const Mesh& mesh, int w, int h)
+{
+	Framebuffer low(w / 2, h / 2), full(w, h);
+	Upscaler upscale;
+
+	upscale(low, full);
+
+	const int runs = 50;
+
+	auto start = bench_clock::now();
+	for (int r = 0; r < runs; ++r)
+		upscale(low, full);
+	const double up = seconds_since(start) / runs;
+
+	cout << "dynamic resolution, " << w << "x" << h << endl;
+	cout << setw(12) << "upscale" << fixed << setprecision(1)
+		<< setw(10) << static_cast<double>(w) * h / up * 1e-6 << " Mpix/s, "
+		<< setprecision(2) << up * 1e3 << " ms from half size" << endl;
+
+	Pipeline<LambertShader> pipe;
+	setup_camera(pipe.shader.cam, w, h, 2.5f);
+	pipe.shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	pipe.shader.color = {0.5f, 0.2f, 1.f};
+
+	const auto frame = [&] (int rw, int rh)
+	{
+		const bench_clock::time_point t = bench_clock::now();
+
+		if (rw != low.width() || rh != low.height()) {
+			low.resize(rw, rh);
+			pipe.set_view(rw, rh);
+		}
+
+		low.clear();
+		pipe.clear();
+		pipe.draw(mesh, low);
+		upscale(low, full);
+
+		return seconds_since(t) * 1e3;
+	};
+
+	frame(w, h);
+
+	double native = 0.;
+	for (int r = 0; r < 5; ++r)
+		native += frame(w, h) / 5;
+
+	// a budget the full resolution cannot meet
+	DynResOptions opts;
+	opts.budget_ms = 0.5 * native;
+
+	ResolutionController control(opts);
+
+	const int frames = 60;
+	unsigned changes = 0;
+	double tail = 0.;
+
+	for (int f = 0; f < frames; ++f) {
+		const double ms = frame(control.width(w), control.height(h));
+		changes += control.update(ms).changed;
+
+		if (f >= frames - 20)
+			tail += ms / 20;
+	}
+
+	cout << setw(12) << "controller" << setw(10) << native << " ms native, budget "
+		<< opts.budget_ms << " ms, settled at " << tail << " ms, scale "
+		<< control.scale() << " (" << control.width(w) << "x" << control.height(h)
+		<< "), " << changes << " changes" << endl;
+}
+
+static void bench_batch(const Mesh& mesh)
+{
+	const int w = 320;
+	const int h = 240;
+	const string prefix = "/tmp/rast_bench_view";
+
+	const Bounds bounds = mesh_bounds(mesh);
+	const vector<View> views = turntable(bounds, 48);
+
+	LambertShader shader;
+	shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	shader.color = {0.5f, 0.2f, 1.f};
+
+	JobSystem jobs;
+
+	cout << "batch render, " << views.size() << " views of " << w << "x" << h << endl;
+
+	for (JobSystem* js: {static_cast<JobSystem*>(nullptr), &jobs}) {
+		BatchRenderer batch(shader, bounds, w, h, js);
+
+		auto const stats = batch.run(mesh, views, prefix);
+
+		cout << setw(12) << (js ? "with jobs" : "serial") << fixed << setprecision(1)
+			<< setw(10) << stats.views / stats.seconds << " views/s" << setw(6)
+			<< stats.workers << " workers" << setw(8) << stats.worker_bytes / 1024
+			<< " KiB each" << (stats.failed ? " (write failed!)" : "") << endl;
+	}
+
+	for (size_t i = 0; i < views.size(); ++i)
+		remove(BatchRenderer::filename(prefix, i).c_str());
+
+	// a column must stand upright in every view of a wide image
+	const Mesh column = make_box({-0.2f, -2.f, -0.2f}, {0.2f, 2.f, 0.2f});
+	const vector<View> around = turntable(mesh_bounds(column), 4);
+
+	const int cw = 200;
+	const int ch = 100;
+
+	BatchRenderer batch(shader, mesh_bounds(column), cw, ch);
+	batch.run(column, around, prefix);
+
+	size_t upright = 0;
+	for (size_t i = 0; i < around.size(); ++i) {
+		vector<rgbacolor_t> pixels(cw * ch);
+
+		ifstream in(BatchRenderer::filename(prefix, i), ios::binary);
+		in.read(reinterpret_cast<char*>(pixels.data()), pixels.size() * sizeof(rgbacolor_t));
+
+		int x0 = cw, x1 = -1, y0 = ch, y1 = -1;
+		for (int y = 0; y < ch; ++y)
+			for (int x = 0; x < cw; ++x) {
+				const rgbacolor_t& p = pixels[y * cw + x];
+
+				if (p.r || p.g || p.b) {
+					x0 = min(x0, x);
+					x1 = max(x1, x);
+					y0 = min(y0, y);
+					y1 = max(y1, y);
+				}
+			}
+
+		upright += x1 >= x0 && y1 - y0 > x1 - x0;
+
+		remove(BatchRenderer::filename(prefix, i).c_str());
+	}
+
+	cout << setw(12) << "orientation" << setw(10) << upright << " of " << around.size()
+		<< " column views upright" << (upright != around.size() ? ", rotated!" : "") << endl;
+}
+
+// Procedural marble on world positions, a costly fragment the cache can pay for
+struct MarbleShader
+{
+	static constexpr bool world_space = true;
+
+	struct varyings {
+		vec3f pos;
+		vec3f norm;
+	};
+
+	Camera cam;
+	vec3f light;
+	vec3f color;
+
+	inline vec4f vertex(const Mesh::vertex& in, varyings& out) const
+	{
+		out.pos = in.pos;
+		out.norm = in.norm;
+		return cam.project(in.pos);
+	}
+
+	inline bgracolor_t fragment(const varyings& in) const
+	{
+		const float nlight = max(0.f, light * in.norm);
+
+		if (nlight == 0.f)
+			return {0, 0, 0, 255};
+
+		// turbulence, eight octaves
+		float t = 0.f;
+		for (float f = 2.f; f <= 256.f; f *= 2.f)
+			t += fabsf(sinf(f * in.pos.x) * sinf(f * in.pos.y + 1.f) * sinf(f * in.pos.z + 2.f)) * 4.f / f;
+
+		const float vein = 0.6f + 0.4f * sinf(6.f * in.pos.x + 8.f * t);
+
+		return to_bgra(color * (nlight * vein));
+	}
+};
+
+template<typename Shader, typename Setup>
+static void bench_temporal(const char* name, const Mesh& mesh, int w, int h, Setup&& setup)
+{
+	const int frames = 60;
+
+	Pipeline<Shader> full, cached;
+
+	for (Pipeline<Shader>* p: {&full, &cached}) {
+		p->set_view(w, h);
+		setup(p->shader);
+	}
+
+	TemporalCache<Shader> cache;
+	cache.resize(w, h);
+
+	Framebuffer a(w, h), b(w, h);
+
+	double tfull = 0., tcached = 0.;
+	size_t differ = 0;
+
+	// the slow orbit of the interactive frame loop
+	for (int f = 0; f < frames; ++f) {
+		const float phi = 1.57f + 0.01f * f;
+		const float theta = 0.01f * f;
+
+		const vec3f dir = {cosf(theta) * sinf(phi), sinf(theta), cosf(theta) * cosf(phi)};
+
+		for (Pipeline<Shader>* p: {&full, &cached}) {
+			Camera& cam = p->shader.cam;
+
+			cam.move = {0.f, 0.f, 0.f};
+			cam.rotater = rotate(dir, {0.f, 0.f, 1.f});
+			cam.campos = dir * 4.f;
+			cam.set_projection(static_cast<float>(w) / h, 0.5f, 25.f);
+		}
+
+		auto start = bench_clock::now();
+		full.clear();
+		a.clear();
+		full.draw(mesh, a);
+		tfull += seconds_since(start);
+
+		start = bench_clock::now();
+		cached.clear();
+		b.clear();
+		cache.draw(cached, mesh, b);
+		tcached += seconds_since(start);
+
+		for (int i = 0; i < w * h; ++i)
+			for (int k = 0; k < 3; ++k)
+				differ += abs(a.data()[i][k] - b.data()[i][k]) > 8;
+	}
+
+	const auto& total = cache.total();
+
+	cout << setw(12) << name << fixed << setprecision(1)
+		<< setw(10) << 100. * total.hit_rate() << "% reused, "
+		<< total.shaded() / frames << " of " << total.covered / frames << " pixels shaded"
+		<< " (" << total.disoccluded / frames << " disoccluded, "
+		<< total.refreshed / frames << " refreshed) per frame" << endl;
+	cout << setw(12) << "frame" << setprecision(2)
+		<< setw(10) << tfull / frames * 1e3 << " ms full"
+		<< setw(10) << tcached / frames * 1e3 << " ms cached, "
+		<< setprecision(3) << 100. * differ / (3. * w * h * frames)
+		<< "% channels off by more than 8" << endl;
+}
+
+// Both shaders light in world space, the cache can not serve view-space lighting
+static void bench_temporal(const Mesh& sphere, int w, int h)
+{
+	const vec3f light = (vec3f{-0.8f, 0.6f, 0.6f}).normalized();
+	const vec3f color = {0.5f, 0.2f, 1.f};
+
+	cout << "temporal reprojection, " << w << "x" << h << ", 60 frames" << endl;
+
+	bench_temporal<WorldLambertShader>("lambert", sphere, w, h, [&] (WorldLambertShader& s)
+	{
+		s.light = light;
+		s.color = color;
+	});
+
+	bench_temporal<MarbleShader>("marble", sphere, w, h, [&] (MarbleShader& s)
+	{
+		s.light = light;
+		s.color = color;
+	});
+}
+
+static void bench_stream(const Mesh& mesh, int w, int h)
+{
+	const int frames = 60;
+	const string address = "unix:/tmp/rast_bench_stream";
+
+	Pipeline<LambertShader> pipe;
+	pipe.set_view(w, h);
+	pipe.shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	pipe.shader.color = {0.5f, 0.2f, 1.f};
+
+	// the slow orbit of the interactive frame loop
+	vector<Framebuffer> rendered(frames, Framebuffer(w, h));
+
+	for (int f = 0; f < frames; ++f) {
+		const float phi = 1.57f + 0.01f * f;
+		const float theta = 0.01f * f;
+
+		const vec3f dir = {cosf(theta) * sinf(phi), sinf(theta), cosf(theta) * cosf(phi)};
+
+		Camera& cam = pipe.shader.cam;
+		cam.move = {0.f, 0.f, 0.f};
+		cam.rotater = rotate(dir, {0.f, 0.f, 1.f});
+		cam.campos = dir * 4.f;
+		cam.set_projection(static_cast<float>(w) / h, 0.5f, 25.f);
+
+		pipe.clear();
+		rendered[f].clear();
+		pipe.draw(mesh, rendered[f]);
+	}
+
+	const size_t raw = w * h * sizeof(bgracolor_t);
+
+	cout << "tile stream, " << w << "x" << h << ", " << frames << " frames, "
+		<< raw / 1024 << " KiB raw" << endl;
+
+	TileEncoder encoder(w, h);
+	vector<uint8_t> message(encoder.max_message());
+
+	uint32_t tiles = 0;
+	const size_t key = encoder.encode(rendered[0].data(), 0, message.data(), tiles);
+
+	size_t bytes = 0;
+	size_t changed = 0;
+
+	auto start = bench_clock::now();
+	for (int f = 1; f < frames; ++f) {
+		bytes += encoder.encode(rendered[f].data(), f, message.data(), tiles);
+		changed += tiles;
+	}
+	const double encode = seconds_since(start) / (frames - 1);
+
+	cout << setw(12) << "key frame" << setw(10) << key / 1024 << " KiB" << fixed << setprecision(1)
+		<< setw(8) << static_cast<double>(raw) / key << "x smaller" << endl;
+	cout << setw(12) << "delta" << setw(10) << bytes / (frames - 1) / 1024 << " KiB"
+		<< setw(8) << static_cast<double>(raw) * (frames - 1) / bytes << "x smaller, "
+		<< changed / (frames - 1) << " tiles, " << setprecision(2) << 1e3 * encode
+		<< " ms encode per frame" << endl;
+
+	// over a socket, with a decoder on the other end
+	TileDecoder decoder;
+	unsigned received = 0;
+	double submit = 0.;
+	StreamServer::stats stats;
+
+	unique_ptr<StreamServer> server(new StreamServer(address, w, h));
+
+	const int fd = stream_connect(address);
+
+	thread viewer([&] {
+		stream_header hdr;
+		while (decoder.read(fd, hdr))
+			++received;
+		close(fd);
+	});
+
+	for (int f = 0; f < frames; ++f) {
+		start = bench_clock::now();
+		server->submit(rendered[f].data());
+		submit += seconds_since(start);
+
+		this_thread::sleep_for(chrono::milliseconds(2));
+	}
+
+	do {
+		this_thread::sleep_for(chrono::milliseconds(1));
+		stats = server->get_stats();
+	} while (stats.sent + stats.dropped + stats.idle < stats.submitted);
+
+	// closing the server ends the stream
+	server.reset();
+	viewer.join();
+
+	remove(address.c_str() + 5);
+
+	const bool same = decoder.width() == w && decoder.height() == h
+		&& !memcmp(decoder.data(), rendered[frames - 1].data(), raw);
+
+	cout << setw(12) << "socket" << setw(10) << stats.sent << " sent" << setw(6) << stats.dropped
+		<< " dropped" << setw(8) << (stats.sent ? stats.bytes / stats.sent / 1024 : 0)
+		<< " KiB/frame" << setprecision(2) << setw(8) << 1e3 * submit / frames
+		<< " ms submit, " << (same && received == stats.sent ? "decoded exact" : "DECODE MISMATCH!")
+		<< endl;
+}
+
+static void bench_depth_only(const char* scene, const Mesh& mesh, float distance, int w, int h)
+{
+	const int frames = 20;
+
+	Pipeline<FlatShader> full, depth;
+
+	for (Pipeline<FlatShader>* p: {&full, &depth}) {
+		p->set_view(w, h);
+		setup_camera(p->shader.cam, w, h, distance);
+		p->shader.color = {1.f, 1.f, 1.f};
+	}
+
+	Framebuffer fb(w, h);
+
+	auto start = bench_clock::now();
+	for (int f = 0; f < frames; ++f) {
+		full.clear();
+		full.draw(mesh, fb);
+	}
+	const double tfull = seconds_since(start) / frames;
+
+	start = bench_clock::now();
+	for (int f = 0; f < frames; ++f) {
+		depth.clear();
+		depth.draw_depth(mesh);
+	}
+	const double tdepth = seconds_since(start) / frames;
+
+	// both must leave the same depth, up to rounding of the plane
+	size_t differ = 0;
+	for (int y = 0; y < h; ++y)
+		for (int x = 0; x < w; ++x)
+			differ += fabsf(full.depth_buffer().read(x, y) - depth.depth_buffer().read(x, y)) > 1e-5f;
+
+	const double tris = mesh.inds.size() / 3;
+
+	cout << setw(8) << scene << setw(9) << static_cast<size_t>(tris) << " tris" << fixed
+		<< setprecision(1) << setw(9) << tris / tfull * 1e-6 << " Mtri/s full"
+		<< setw(9) << tris / tdepth * 1e-6 << " Mtri/s depth only"
+		<< setprecision(2) << setw(8) << tfull / tdepth << "x, "
+		<< differ << " pixels differ" << endl;
+}
+
+static void bench_shadows(const Mesh& sphere, int w, int h)
+{
+	const int frames = 20;
+
+	// the sphere over a floor that catches its shadow
+	Mesh scene = sphere;
+	{
+		const Mesh floor = make_walls(1, 4.f);
+		const Mesh::uint base = scene.verts.size();
+
+		scene.verts.insert(scene.verts.end(), floor.verts.begin(), floor.verts.end());
+		for (Mesh::uint i: floor.inds)
+			scene.inds.push_back(base + i);
+	}
+
+	const vec3f light = (vec3f{-0.8f, 0.6f, 0.6f}).normalized();
+
+	Pipeline<LambertShader> plain;
+	plain.set_view(w, h);
+	setup_camera(plain.shader.cam, w, h, 6.f);
+	plain.shader.light = light;
+	plain.shader.color = {0.5f, 0.2f, 1.f};
+
+	ShadowMap map;
+	map.fit(light, {0.f, 0.f, 0.f}, 4.f * sqrtf(2.f));
+
+	Pipeline<ShadowShader> shaded;
+	shaded.set_view(w, h);
+	shaded.shader.cam = plain.shader.cam;
+	shaded.shader.light = light;
+	shaded.shader.color = plain.shader.color;
+	shaded.shader.shadows = &map;
+
+	Framebuffer a(w, h), b(w, h);
+
+	auto start = bench_clock::now();
+	for (int f = 0; f < frames; ++f) {
+		plain.clear();
+		a.clear();
+		plain.draw(scene, a);
+	}
+	const double tplain = seconds_since(start) / frames;
+
+	// light and scene stay put, so the map is rendered once
+	start = bench_clock::now();
+	map.update(scene);
+	const double tmap = seconds_since(start);
+
+	size_t renders = 0;
+
+	start = bench_clock::now();
+	for (int f = 0; f < frames; ++f) {
+		renders += map.update(scene);
+
+		shaded.clear();
+		b.clear();
+		shaded.draw(scene, b);
+	}
+	const double tshaded = seconds_since(start) / frames;
+
+	// pixels lit in the plain frame that the shadow map darkens
+	size_t shadowed = 0, covered = 0;
+	for (int i = 0; i < w * h; ++i) {
+		const bgracolor_t& pa = a.data()[i];
+		const bgracolor_t& pb = b.data()[i];
+
+		if (pa.r | pa.g | pa.b) {
+			++covered;
+			shadowed += pb.r + pb.g + pb.b < (pa.r + pa.g + pa.b) / 2;
+		}
+	}
+
+	cout << "shadow map, 1024x1024 pcf 3x3, " << w << "x" << h << endl;
+	cout << setw(12) << "frame" << fixed << setprecision(2)
+		<< setw(10) << tplain * 1e3 << " ms plain"
+		<< setw(10) << tshaded * 1e3 << " ms shadowed, shadow pass "
+		<< tmap * 1e3 << " ms once" << (renders ? " (rendered again!)" : "")
+		<< ", " << setprecision(1)
+		<< 100. * shadowed / max<size_t>(covered, 1) << "% of lit pixels in shadow, "
+		<< map.memory_usage() / 1024 << " KiB" << endl;
+}
+
+static void bench_tiled(const Mesh& mesh, int w, int h)
+{
+	const int frames = 20;
+
+	Pipeline<LambertShader> pipe;
+	pipe.set_view(w, h);
+	setup_camera(pipe.shader.cam, w, h, 2.2f);
+	pipe.shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	pipe.shader.color = {0.5f, 0.2f, 1.f};
+
+	Framebuffer linear(w, h);
+	TiledFramebuffer tiled(w, h);
+	Framebuffer presented(w, h);
+	FBWriter writer({static_cast<uint16_t>(w), static_cast<uint16_t>(h)});
+
+	JobSystem jobs;
+	PerfCounters counters;
+
+	PerfCounters::sample before = {}, after = {};
+	double tlinear = 0., ttiled = 0., tpresent = 0., tjobs = 0.;
+
+	for (int f = 0; f < frames; ++f) {
+		auto start = bench_clock::now();
+		counters.start();
+		pipe.clear();
+		linear.clear();
+		pipe.draw(mesh, linear);
+		const auto a = counters.stop();
+		tlinear += seconds_since(start);
+
+		start = bench_clock::now();
+		counters.start();
+		pipe.clear();
+		tiled.clear();
+		pipe.draw(mesh, tiled);
+		const auto b = counters.stop();
+		ttiled += seconds_since(start);
+
+		start = bench_clock::now();
+		tiled.present(presented.data());
+		tpresent += seconds_since(start);
+
+		start = bench_clock::now();
+		tiled.present(writer, &jobs);
+		tjobs += seconds_since(start);
+
+		for (int e = 0; e < PerfCounters::count; ++e) {
+			before.value[e] += a.value[e];
+			after.value[e] += b.value[e];
+		}
+	}
+
+	// the written rgba must be the linear frame with r and b swapped
+	bool rgba = true;
+	for (int i = 0; i < w * h && rgba; ++i) {
+		const bgracolor_t& p = linear.data()[i];
+		const rgbacolor_t& q = writer.data()[i];
+		rgba = q[0] == p.r && q[1] == p.g && q[2] == p.b && q[3] == p.a;
+	}
+
+	const bool same = !memcmp(linear.data(), presented.data(), w * h * sizeof(bgracolor_t));
+
+	cout << "tiled color buffer, " << w << "x" << h << ", " << tiled.backing() << " pages" << endl;
+	cout << setw(12) << "frame" << fixed << setprecision(2)
+		<< setw(10) << tlinear / frames * 1e3 << " ms linear"
+		<< setw(10) << ttiled / frames * 1e3 << " ms tiled"
+		<< setw(10) << tpresent / frames * 1e3 << " ms present"
+		<< setw(10) << tjobs / frames * 1e3 << " ms rgba with jobs, "
+		<< (same && rgba ? "identical" : "MISMATCH!") << endl;
+
+	if (!counters.any()) {
+		cout << setw(12) << "counters" << "  not available here" << endl;
+		return;
+	}
+
+	for (int e = 0; e < PerfCounters::count; ++e) {
+		const PerfCounters::event ev = static_cast<PerfCounters::event>(e);
+
+		cout << setw(20) << PerfCounters::name(ev);
+
+		if (counters.available(ev))
+			cout << setw(12) << before.value[e] / frames << " linear"
+				<< setw(12) << after.value[e] / frames << " tiled per frame" << endl;
+		else
+			cout << "  not available" << endl;
+	}
+}
+
+// Runs frame() a few times to warm up, then counts allocations per frame
+template<typename Frame>
+static size_t steady_allocs(const char* name, Frame&& frame)
+{
+	const int warmup = 10;
+	const int frames = 10;
+
+	for (int f = 0; f < warmup; ++f)
+		frame();
+
+	// with few cores a worker may touch its arena for the first time late,
+	// so a window with allocations gets a couple more chances to settle
+	size_t allocs = 0;
+
+	for (int attempt = 0; attempt < 3; ++attempt) {
+		const size_t before = alloc_count();
+
+		for (int f = 0; f < frames; ++f)
+			frame();
+
+		allocs = alloc_count() - before;
+
+		if (!allocs)
+			break;
+	}
+
+	cout << setw(12) << name << setw(10) << fixed << setprecision(1)
+		<< static_cast<double>(allocs) / frames << " allocs/frame" << endl;
+
+	return allocs;
+}
+
+static size_t bench_allocations(const Mesh& mesh, int w, int h)
+{
+	LambertShader shader;
+	setup_camera(shader.cam, w, h, 4.f);
+	shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	shader.color = {0.5f, 0.2f, 1.f};
+
+	Framebuffer fb(w, h);
+
+	JobOptions opts;
+	opts.threads = 2;
+	JobSystem jobs(opts);
+
+	ArenaSet arenas;
+
+	Pipeline<LambertShader> serial(shader), parallel(shader);
+	serial.set_view(w, h);
+	parallel.set_view(w, h);
+	parallel.set_jobs(&jobs);
+	parallel.set_arenas(&arenas);
+
+	MSAATarget<4> msaa;
+	msaa.resize(w, h);
+
+	Wireframe wf(mesh);
+	const auto project = [&shader] (const vec3f& pos) { return shader.cam.project(pos); };
+
+	if (!alloc_count())
+		cout << "allocations: build with -DRAST_COUNT_ALLOCS to count" << endl;
+	else
+		cout << "steady-state allocations" << endl;
+
+	size_t total = 0;
+
+	total += steady_allocs("serial", [&]
+	{
+		serial.clear();
+		fb.clear();
+		serial.draw(mesh, fb);
+	});
+
+	total += steady_allocs("jobs", [&]
+	{
+		parallel.clear();
+		fb.clear();
+		parallel.draw(mesh, fb);
+		arenas.reset();
+	});
+
+	total += steady_allocs("msaa 4x", [&]
+	{
+		msaa.clear();
+		serial.draw(mesh, msaa);
+		msaa.resolve(fb);
+	});
+
+	total += steady_allocs("wireframe", [&]
+	{
+		wf.draw(mesh, project, fb, {255u, 255u, 255u, 255u});
+	});
+
+	cout << setw(12) << "arenas" << setw(10) << arenas.count() << " threads, "
+		<< arenas.high_water() / 1024 << " KiB high water, "
+		<< arenas.capacity() / 1024 << " KiB reserved" << endl;
+
+	return total;
+}
+
+int main(int argc, char** argv)
+{
+	const int w = argc > 2 ? atoi(argv[1]) : 1280;
+	const int h = argc > 2 ? atoi(argv[2]) : 720;
+
+	const Mesh sphere = make_sphere(64, 128, 1.5f);
+	const Mesh walls = make_walls(8, 4.f);
+
+	cout << "depth buffer, " << w << "x" << h << endl;
+
+	bench_depth_all<DepthFormat::unorm16>(w, h, sphere, walls);
+	bench_depth_all<DepthFormat::unorm24>(w, h, sphere, walls);
+	bench_depth_all<DepthFormat::float32>(w, h, sphere, walls);
+	bench_depth_all<DepthFormat::reversed32>(w, h, sphere, walls);
+
+	cout << "depth only, " << w << "x" << h << endl;
+
+	bench_depth_only("sphere", sphere, 4.f, w, h);
+	bench_depth_only("dense", make_sphere(256, 512, 1.5f), 4.f, w, h);
+	bench_depth_only("walls", walls, 6.f, w, h);
+
+	bench_shadows(sphere, w, h);
+
+	bench_tiled(sphere, w, h);
+
+	bench_frame_pipeline(sphere, w, h);
+
+	bench_jobs(sphere, w, h);
+
+	bench_lines(sphere, w, h);
+
+	bench_packed(w, h);
+
+	bench_dynres(sphere, w, h);
+
+	bench_batch(sphere);
+
+	bench_temporal(sphere, w, h);
+
+	bench_stream(sphere, w, h);
+
+	// a steady frame loop must not touch the heap
+	return bench_allocations(sphere, w, h) ? 1 : 0;
+}
@@ -33,6 +33,25 @@ public:
 		return {x, y}; 
 	}
 	
+	/*
+	 * Homogeneous form of real2screen in the Pipeline convention: x / w and
+	 * y / w are the screen coords, w is the (negative) depth, and z is set
+	 * so that points closer than near fail the near-plane test z + w <= 0.
+	 */
+	vec4f real2clip(const realcoords_t& coords, float near = 1e-3f) const
+	{
+		return {-distance * coords.x / resolution.w, 
+				-distance * coords.y / resolution.h, 
+				near, 
+				coords.z};
+	}
+	
+	vec2f clip2pixel(const vec4f& coords) const
+	{
+		return {(coords.x / coords.w + 1.f) * resolution.w / 2.f,
+				(coords.y / coords.w + 1.f) * resolution.h / 2.f};
+	}
+	
 	pixelcoords_t screen2pixel(const screencoords_t& coords) const
 	{
 		assert(fabsf(coords.x) < 1.f);
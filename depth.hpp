@@ -0,0 +1,318 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+
+#include "rasterizer.hpp"
+
+using namespace std;
+
+enum class DepthFormat
+{
+	unorm16,
+	unorm24,
+	float32,
+	reversed32
+};
+
+/*
+ * Storage type and conversion from NDC depth in [-1, 1].
+ * passes(a, b) tells whether a new value a wins over the stored b.
+ */
+template<DepthFormat F>
+struct DepthTraits;
+
+template<>
+struct DepthTraits<DepthFormat::unorm16>
+{
+	using type = uint16_t;
+	static constexpr const char* name = "unorm16";
+
+	static inline type encode(float z)
+	{
+		return static_cast<type>((z * 0.5f + 0.5f) * 65535.f + 0.5f);
+	}
+
+	static inline float decode(type d)
+	{
+		return d * (2.f / 65535.f) - 1.f;
+	}
+
+	static inline bool passes(type a, type b) { return a <= b; }
+};
+
+// 24 significant bits in a 32-bit word, like D24X8
+template<>
+struct DepthTraits<DepthFormat::unorm24>
+{
+	using type = uint32_t;
+	static constexpr const char* name = "unorm24";
+
+	static inline type encode(float z)
+	{
+		return static_cast<type>((z * 0.5f + 0.5f) * 16777215.f + 0.5f);
+	}
+
+	static inline float decode(type d)
+	{
+		return d * (2.f / 16777215.f) - 1.f;
+	}
+
+	static inline bool passes(type a, type b) { return a <= b; }
+};
+
+template<>
+struct DepthTraits<DepthFormat::float32>
+{
+	using type = float;
+	static constexpr const char* name = "float32";
+
+	static inline type encode(float z) { return z; }
+	static inline float decode(type d) { return d; }
+
+	static inline bool passes(type a, type b) { return a <= b; }
+};
+
+// Far plane at 0: keeps the float exponent range where depth is dense
+template<>
+struct DepthTraits<DepthFormat::reversed32>
+{
+	using type = float;
+	static constexpr const char* name = "reversed32";
+
+	static inline type encode(float z) { return (1.f - z) * 0.5f; }
+	static inline float decode(type d) { return 1.f - 2.f * d; }
+
+	static inline bool passes(type a, type b) { return a >= b; }
+};
+
+/*
+ * Depth buffer stored in 8x8 tiles. A tile is either cleared, described
+ * by a single plane (when one triangle covered all of it) or expanded to
+ * per-pixel values; per-pixel storage is only touched for expanded tiles.
+ */
+template<DepthFormat F = DepthFormat::float32>
+class DepthBuffer
+{
+public:
+	using traits = DepthTraits<F>;
+	using type = typename traits::type;
+
+	static constexpr int tilesize = 8;
+	static constexpr int tilepixels = tilesize * tilesize;
+
+private:
+	enum tilestate : uint8_t {
+		tile_cleared,
+		tile_plane,
+		tile_expanded
+	};
+
+	struct tile {
+		tilestate state;
+		Rasterizer::zplane plane;
+	};
+
+	int w, h, tw, th;
+
+	vector<type> data;
+	vector<tile> tiles;
+
+	inline type* tile_data(int t)
+	{
+		return &data[static_cast<size_t>(t) * tilepixels];
+	}
+
+	inline void expand(int t)
+	{
+		tile& tl = tiles[t];
+		type* d = tile_data(t);
+
+		if (tl.state == tile_cleared)
+			fill(d, d + tilepixels, traits::encode(1.f));
+		else if (tl.state == tile_plane) {
+			const int x0 = t % tw * tilesize;
+			const int y0 = t / tw * tilesize;
+
+			for (int y = 0; y < tilesize; ++y)
+				for (int x = 0; x < tilesize; ++x)
+					d[y * tilesize + x] =
+						traits::encode(tl.plane.at(x0 + x, y0 + y));
+		}
+
+		tl.state = tile_expanded;
+	}
+
+	// Range of the plane over the pixel centers of the tile at (x0, y0)
+	static inline void plane_range(const Rasterizer::zplane& p, int x0, int y0,
+									float& zmin, float& zmax)
+	{
+		const float z = p.at(x0, y0);
+		const float dx = p.dzdx * (tilesize - 1);
+		const float dy = p.dzdy * (tilesize - 1);
+
+		zmin = z + min(dx, 0.f) + min(dy, 0.f);
+		zmax = z + max(dx, 0.f) + max(dy, 0.f);
+	}
+
+public:
+	DepthBuffer() : w(0), h(0), tw(0), th(0)
+	{
+	}
+
+	inline void resize(int width, int height)
+	{
+		w = width;
+		h = height;
+
+		tw = (w + tilesize - 1) / tilesize;
+		th = (h + tilesize - 1) / tilesize;
+
+		data.assign(static_cast<size_t>(tw) * th * tilepixels, traits::encode(1.f));
+		tiles.assign(tw * th, tile{tile_cleared, {}});
+	}
+
+	inline int width() const { return w; }
+	inline int height() const { return h; }
+
+	// O(tiles): pixel storage is refilled lazily on expansion
+	inline void clear()
+	{
+		for (tile& t: tiles)
+			t.state = tile_cleared;
+	}
+
+	inline size_t offset(int x, int y) const
+	{
+		const size_t t = (y / tilesize) * tw + x / tilesize;
+
+		return t * tilepixels + (y % tilesize) * tilesize + x % tilesize;
+	}
+
+	// Depth test and write for one pixel; nothing outside [-1, 1] passes
+	inline bool test(int x, int y, float z)
+	{
+		if (z < -1.f || z > 1.f)
+			return false;
+
+		const int t = (y / tilesize) * tw + x / tilesize;
+
+		if (tiles[t].state != tile_expanded)
+			expand(t);
+
+		type& d = data[offset(x, y)];
+		const type e = traits::encode(z);
+
+		if (!traits::passes(e, d))
+			return false;
+
+		d = e;
+		return true;
+	}
+
+	// test() down rows y0..y1 of one column within a tile, z stepped by dzdy
+	inline void test_column(int x, int y0, int y1, float z, float dzdy)
+	{
+		assert(y0 / tilesize == y1 / tilesize);
+
+		const int t = (y0 / tilesize) * tw + x / tilesize;
+
+		if (tiles[t].state != tile_expanded)
+			expand(t);
+
+		type* d = tile_data(t) + (y0 % tilesize) * tilesize + x % tilesize;
+
+		for (int y = y0; y <= y1; ++y, d += tilesize, z += dzdy) {
+			if (z < -1.f || z > 1.f)
+				continue;
+
+			const type e = traits::encode(z);
+
+			if (traits::passes(e, *d))
+				*d = e;
+		}
+	}
+
+	/*
+	 * Tile-level test for the block at pixel (x0, y0). Accepting means
+	 * every covered pixel passes and the tile now holds the new plane.
+	 */
+	inline Rasterizer::blockmode test_block(int x0, int y0, bool full,
+											const Rasterizer::zplane& p)
+	{
+		tile& tl = tiles[(y0 / tilesize) * tw + x0 / tilesize];
+
+		float zmin, zmax;
+		plane_range(p, x0, y0, zmin, zmax);
+
+		if (zmax < -1.f || zmin > 1.f)
+			return Rasterizer::block_reject;
+
+		if (tl.state == tile_expanded || zmin < -1.f)
+			return Rasterizer::block_test;
+
+		if (tl.state == tile_cleared) {
+			if (!full || zmax > 1.f)
+				return Rasterizer::block_test;
+
+			tl.state = tile_plane;
+			tl.plane = p;
+			return Rasterizer::block_accept;
+		}
+
+		float omin, omax;
+		plane_range(tl.plane, x0, y0, omin, omax);
+
+		if (zmin > omax)
+			return Rasterizer::block_reject;
+
+		if (!full || zmax > omin)
+			return Rasterizer::block_test;
+
+		tl.plane = p;
+		return Rasterizer::block_accept;
+	}
+
+	// Nothing has been drawn to the tile holding the pixel since clear()
+	inline bool cleared(int x, int y) const
+	{
+		return tiles[(y / tilesize) * tw + x / tilesize].state == tile_cleared;
+	}
+
+	// NDC depth at the pixel, whatever the state of its tile
+	inline float read(int x, int y) const
+	{
+		const tile& tl = tiles[(y / tilesize) * tw + x / tilesize];
+
+		if (tl.state == tile_cleared)
+			return 1.f;
+		if (tl.state == tile_plane)
+			return tl.plane.at(x, y);
+
+		return traits::decode(data[offset(x, y)]);
+	}
+
+	inline size_t plane_tiles() const
+	{
+		return count_if(tiles.begin(), tiles.end(),
+			[] (const tile& t) { return t.state == tile_plane; });
+	}
+
+	inline size_t expanded_tiles() const
+	{
+		return count_if(tiles.begin(), tiles.end(),
+			[] (const tile& t) { return t.state == tile_expanded; });
+	}
+
+	inline size_t tile_count() const
+	{
+		return tiles.size();
+	}
+
+	inline size_t memory_usage() const
+	{
+		return data.capacity() * sizeof(type) + tiles.capacity() * sizeof(tile);
+	}
+};
@@ -1,6 +1,7 @@
 #include "linalg.hpp"
 #include "coordscounter.hpp"
 #include "xwindow.hpp"
+#include "lines.hpp"
 
 struct line_t
 {
@@ -17,6 +18,8 @@ class Drawyer
 private:
     CoordsCounter *cc;
     XWindow *xw;
+    
+    std::vector<segment_t> segs;
 public:
     Drawyer()
     {
@@ -26,50 +29,37 @@ public:
     
     void draw(const line_t& line, const bgracolor_t& color)
     {
-        pixelcoords_t start = cc->real2pixel(line.dots[0]);
-        pixelcoords_t end 	= cc->real2pixel(line.dots[1]);
-        
-        bool xORy = fabs(start.x - end.x) > fabs(start.y - end.y);
-        
-        if (( xORy && (start.x > end.x)) ||
-            (!xORy && (start.y > end.y)))
-            std::swap(start, end);
-            
-        //std::cout << "Start: x[" << start.x << "] y[" << start.y << "]" << std::endl;
-        //std::cout << "End: x[" << end.x << "] y[" << end.y << "]" << std::endl;
-        
-        uint16_t iterStart 	= 0;
-        uint16_t iterEnd 	= 0;
-        uint16_t initial	= 0;
-        
-        float tg = 0;
+        draw(&line, 1, color);
+    }
+    
+    // Projects the whole batch, then clips and rasterizes it in integers
+    void draw(const line_t* lines, size_t count, const bgracolor_t& color)
+    {
+        segs.clear();
         
-        if (xORy) {
-            initial 	= start.y;
-            
-            iterStart 	= start.x;
-            iterEnd 	= end.x;
+        for (size_t i = 0; i < count; ++i) {
+            vec4f a = cc->real2clip(lines[i].dots[0]);
+            vec4f b = cc->real2clip(lines[i].dots[1]);
             
-            tg = float(end.y - start.y) / float(end.x - start.x);
-        }
-        else {
-            initial 	= start.x;
-            
-            iterStart 	= start.y;
-            iterEnd 	= end.y;
+            if (!clip_near(a, b))
+                continue;
             
-            tg = float(end.x - start.x) / float(end.y - start.y);
+            segs.push_back({{cc->clip2pixel(a), cc->clip2pixel(b)}});
         }
         
-        //std::cout << "Initial: " << initial << std::endl;
-        //std::cout << "IterStart: " << iterStart << " IterEnd: " << iterEnd << std::endl;
-        //std::cout << "TG: " << tg << std::endl;
-        
-        for (uint16_t i = iterStart; i <= iterEnd; ++i) {
-            uint16_t j = initial + std::lround(tg * (i - iterStart));
-            //std::cout << i << " " << j << std::endl;
-            (*xw)[xORy ? pixelcoords_t({i, j}) : pixelcoords_t({j, i})] = color;
-        }
+        draw_segments(*xw, segs.data(), segs.size(), color);
+    }
+    
+    void draw(const std::vector<line_t>& lines, const bgracolor_t& color)
+    {
+        draw(lines.data(), lines.size(), color);
+    }
+    
+    // Wireframe of a mesh given in real coords, edges come from wf
+    void draw(Wireframe& wf, const Mesh& mesh, const bgracolor_t& color)
+    {
+        wf.draw(mesh, [this] (const vec3f& pos) { return cc->real2clip(pos); }, 
+                *xw, color);
     }
     
     void draw(const triangle_t& triangle, const bgracolor_t& color) 
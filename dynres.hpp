@@ -0,0 +1,274 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "linalg.hpp"
+
+using namespace std;
+
+struct DynResOptions
+{
+	double budget_ms = 16.7;
+
+	float min_scale = 0.25f;
+	float max_scale = 1.f;
+
+	// relative change of the scale below which nothing happens
+	float deadband = 0.05f;
+
+	// frames to wait after a change before the next one
+	unsigned cooldown = 4;
+};
+
+/*
+ * Picks the render scale for the next frame from the frame times so far.
+ * Raster cost goes with the pixel count, so the scale that meets the
+ * budget is scale * sqrt(budget / time). Frame times are smoothed, faster
+ * when they rise than when they fall: heavy frames are answered within a
+ * frame or two, the way back up is cautious.
+ */
+class ResolutionController
+{
+public:
+	struct decision {
+		unsigned frame;
+		double ms, avg_ms;
+		float scale;
+		bool changed;
+	};
+
+private:
+	DynResOptions opts;
+
+	float current;
+	double avg;
+
+	unsigned frames;
+	unsigned last_change;
+
+public:
+	ResolutionController(const DynResOptions& options = DynResOptions()) :
+		opts(options), current(options.max_scale), avg(0.),
+		frames(0), last_change(0)
+	{
+	}
+
+	inline const DynResOptions& options() const
+	{
+		return opts;
+	}
+
+	inline float scale() const
+	{
+		return current;
+	}
+
+	// Render size for a full size of w x h, never below one depth tile
+	inline int width(int w) const
+	{
+		return max(8, static_cast<int>(lround(w * current)));
+	}
+
+	inline int height(int h) const
+	{
+		return max(8, static_cast<int>(lround(h * current)));
+	}
+
+	inline decision update(double ms)
+	{
+		const double alpha = ms > avg ? 0.5 : 0.1;
+
+		avg = frames ? avg + alpha * (ms - avg) : ms;
+		++frames;
+
+		decision retval = {frames, ms, avg, current, false};
+
+		if (frames - last_change < opts.cooldown || avg <= 0.)
+			return retval;
+
+		float target = current * static_cast<float>(sqrt(opts.budget_ms / avg));
+		target = min(max(target, opts.min_scale), opts.max_scale);
+
+		if (fabsf(target - current) <= opts.deadband * current)
+			return retval;
+
+		// the smoothed time is carried over to what the new size should cost
+		avg *= (target / current) * (target / current);
+
+		current = target;
+		last_change = frames;
+
+		retval.scale = current;
+		retval.changed = true;
+
+		return retval;
+	}
+};
+
+/*
+ * Bilinear resampling between two row-major bgra buffers with the same
+ * row order, such as Framebuffer and the XWindow image. A vertical pass
+ * blends two source rows into a 16-bit row, a horizontal pass then reads
+ * both neighbours of a column with one load. Column tables are kept
+ * between frames and only rebuilt when a size changes.
+ */
+class Upscaler
+{
+private:
+	int sw, sh, dw;
+
+	vector<int> column;
+	vector<uint16_t> weight;
+	vector<uint16_t> row;
+
+	static inline void source_of(int d, int dsize, int ssize, int& s, uint16_t& frac)
+	{
+		const float x = (d + 0.5f) * ssize / dsize - 0.5f;
+		const float c = min(max(x, 0.f), static_cast<float>(ssize - 1));
+
+		s = static_cast<int>(c);
+		frac = static_cast<uint16_t>((c - s) * 256.f);
+	}
+
+	inline void prepare(int srcw, int srch, int dstw)
+	{
+		if (srcw == sw && srch == sh && dstw == dw)
+			return;
+
+		sw = srcw;
+		sh = srch;
+		dw = dstw;
+
+		column.resize(dw);
+		weight.resize(dw);
+
+		for (int x = 0; x < dw; ++x)
+			source_of(x, dw, sw, column[x], weight[x]);
+
+		// one spare pixel so the last column can read its right neighbour
+		row.resize(4 * (sw + 1) + 8);
+	}
+
+	inline void blend_rows(const bgracolor_t* top, const bgracolor_t* bottom, uint16_t fy)
+	{
+		const uint8_t* t = reinterpret_cast<const uint8_t*>(top);
+		const uint8_t* b = reinterpret_cast<const uint8_t*>(bottom);
+
+		const int n = 4 * sw;
+		int i = 0;
+
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i wt = _mm_set1_epi16(256 - fy);
+		const __m128i wb = _mm_set1_epi16(fy);
+		const __m128i half = _mm_set1_epi16(128);
+
+		for (; i + 16 <= n; i += 16) {
+			const __m128i vt = _mm_loadu_si128(reinterpret_cast<const __m128i*>(t + i));
+			const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+
+			const __m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+				_mm_mullo_epi16(_mm_unpacklo_epi8(vt, zero), wt),
+				_mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), wb)), half), 8);
+
+			const __m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(
+				_mm_mullo_epi16(_mm_unpackhi_epi8(vt, zero), wt),
+				_mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), wb)), half), 8);
+
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&row[i]), lo);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(&row[i + 8]), hi);
+		}
+#endif
+
+		for (; i < n; ++i)
+			row[i] = (t[i] * (256 - fy) + b[i] * fy + 128) >> 8;
+
+		for (int k = 0; k < 4; ++k)
+			row[n + k] = row[n - 4 + k];
+	}
+
+	inline void blend_columns(bgracolor_t* dst) const
+	{
+		int x = 0;
+
+#ifdef __SSE2__
+		const __m128i half = _mm_set1_epi16(128);
+
+		for (; x + 2 <= dw; x += 2) {
+			const __m128i a = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(&row[4 * column[x]]));
+			const __m128i b = _mm_loadu_si128(
+				reinterpret_cast<const __m128i*>(&row[4 * column[x + 1]]));
+
+			// (256 - f) for the left pixel's four lanes, f for the right's
+			const __m128i wa = _mm_unpacklo_epi64(
+				_mm_set1_epi16(256 - weight[x]), _mm_set1_epi16(weight[x]));
+			const __m128i wb = _mm_unpacklo_epi64(
+				_mm_set1_epi16(256 - weight[x + 1]), _mm_set1_epi16(weight[x + 1]));
+
+			const __m128i pa = _mm_mullo_epi16(a, wa);
+			const __m128i pb = _mm_mullo_epi16(b, wb);
+
+			const __m128i sa = _mm_add_epi16(pa, _mm_srli_si128(pa, 8));
+			const __m128i sb = _mm_add_epi16(pb, _mm_srli_si128(pb, 8));
+
+			const __m128i sum = _mm_srli_epi16(
+				_mm_add_epi16(_mm_unpacklo_epi64(sa, sb), half), 8);
+
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(dst + x),
+								_mm_packus_epi16(sum, sum));
+		}
+#endif
+
+		for (; x < dw; ++x) {
+			const uint16_t* p = &row[4 * column[x]];
+			const int f = weight[x];
+
+			for (int k = 0; k < 4; ++k)
+				dst[x][k] = (p[k] * (256 - f) + p[k + 4] * f + 128) >> 8;
+		}
+	}
+
+public:
+	Upscaler() : sw(0), sh(0), dw(0)
+	{
+	}
+
+	inline void resample(const bgracolor_t* src, int srcw, int srch,
+							bgracolor_t* dst, int dstw, int dsth)
+	{
+		prepare(srcw, srch, dstw);
+
+		int prev = -1;
+		uint16_t prevf = 0;
+
+		for (int y = 0; y < dsth; ++y) {
+			int sy;
+			uint16_t fy;
+			source_of(y, dsth, sh, sy, fy);
+
+			// neighbouring rows often share their source rows and weight
+			if (sy != prev || fy != prevf)
+				blend_rows(src + sy * sw, src + min(sy + 1, sh - 1) * sw, fy);
+
+			prev = sy;
+			prevf = fy;
+
+			blend_columns(dst + y * dw);
+		}
+	}
+
+	template<typename Source, typename Target>
+	inline void operator()(const Source& src, Target& dst)
+	{
+		resample(src.data(), src.width(), src.height(),
+					dst.data(), dst.width(), dst.height());
+	}
+};
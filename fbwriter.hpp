@@ -1,4 +1,7 @@
+#pragma once
+
 #include <vector>
+#include <cassert>
 #include <cinttypes>
 #include <fstream>
 
@@ -18,8 +21,8 @@ public:
 	const resolution_t 		resolution;
 
 	FBWriter(const resolution_t& res) :
-		resolution(res),
-		buffer(res.w * res.h)
+		buffer(res.w * res.h),
+		resolution(res)
 	{
 	}
 	
@@ -35,6 +38,17 @@ public:
 		filebuf.open(filename, std::ios::out | std::ios::binary);
 	}
 	
+	void close()
+	{
+		if (filebuf.is_open())
+			filebuf.close();
+	}
+	
+	rgbacolor_t* data()
+	{
+		return buffer.data();
+	}
+	
 	void flush() 
 	{
 		assert(is_open());
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "linalg.hpp"
+
+// Headless color target laid out like the XWindow image: bottom-up rows
+class Framebuffer
+{
+private:
+	int w, h;
+	std::vector<bgracolor_t> pixels;
+
+public:
+	Framebuffer(int width = 0, int height = 0)
+	{
+		resize(width, height);
+	}
+
+	inline void resize(int width, int height)
+	{
+		w = width;
+		h = height;
+		pixels.assign(w * h, bgracolor_t{0, 0, 0, 255});
+	}
+
+	inline int width() const { return w; }
+	inline int height() const { return h; }
+
+	inline void clear(const bgracolor_t& c = {0, 0, 0, 255})
+	{
+		std::fill(pixels.begin(), pixels.end(), c);
+	}
+
+	inline bgracolor_t* data() { return pixels.data(); }
+	inline const bgracolor_t* data() const { return pixels.data(); }
+
+	inline size_t memory_usage() const
+	{
+		return pixels.capacity() * sizeof(bgracolor_t);
+	}
+
+	inline bgracolor_t& operator[](const vec2i& coords)
+	{
+		assert(coords.x < w);
+		assert(coords.y < h);
+
+		return pixels[w * (h - coords.y - 1) + coords.x];
+	}
+
+	inline const bgracolor_t& operator[](const vec2i& coords) const
+	{
+		assert(coords.x < w);
+		assert(coords.y < h);
+
+		return pixels[w * (h - coords.y - 1) + coords.x];
+	}
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <chrono>
+
+#include "pipeline.hpp"
+#include "framebuffer.hpp"
+
+using namespace std;
+
+// Lock-free ring for exactly one producer thread and one consumer thread
+template<typename T, size_t N>
+class SpscQueue
+{
+	static_assert((N & (N - 1)) == 0, "capacity must be a power of two");
+
+private:
+	T items[N];
+
+	alignas(64) atomic<size_t> head;
+	alignas(64) atomic<size_t> tail;
+
+public:
+	SpscQueue() : head(0), tail(0)
+	{
+	}
+
+	inline bool push(const T& item)
+	{
+		const size_t t = tail.load(memory_order_relaxed);
+
+		if (t - head.load(memory_order_acquire) == N)
+			return false;
+
+		items[t % N] = item;
+		tail.store(t + 1, memory_order_release);
+		return true;
+	}
+
+	inline bool pop(T& item)
+	{
+		const size_t h = head.load(memory_order_relaxed);
+
+		if (h == tail.load(memory_order_acquire))
+			return false;
+
+		item = items[h % N];
+		head.store(h + 1, memory_order_release);
+		return true;
+	}
+};
+
+/*
+ * Three-stage frame pipeline: the geometry thread transforms frame N+1
+ * while the raster thread draws frame N and the calling thread presents
+ * frame N-1. At most 'depth' frames are in flight; their resources cycle
+ * through the stages and are reused, never reallocated.
+ *
+ * Update is called as update(frame, shader) on the geometry thread to set
+ * the frame's uniforms, Present as present(const Framebuffer&) on the
+ * calling thread. With a job system both the geometry and the raster
+ * stage fan their work out over it. The stage threads live for one run();
+ * a run of count 0 never returns and reports its stats in windows.
+ */
+template<typename Shader, DepthFormat F = DepthFormat::float32>
+class FramePipeline
+{
+public:
+	using pipeline = Pipeline<Shader, F>;
+	using vertex_out = typename pipeline::vertex_out;
+
+	static constexpr int max_depth = 8;
+
+	struct stats {
+		unsigned frames;
+		double seconds;
+		double geometry, raster, present;
+	};
+
+private:
+	struct Frame {
+		Shader shader;
+		vector<vertex_out> vout;
+		Framebuffer color;
+	};
+
+	using queue = SpscQueue<Frame*, max_depth>;
+
+	const Mesh& mesh;
+	pipeline raster;
+
+	int depth;
+	vector<unique_ptr<Frame>> frames;
+
+	JobSystem* jobs;
+
+	queue free_frames, transformed, rastered;
+
+	template<typename Q>
+	static inline Frame* wait_pop(Q& q)
+	{
+		Frame* f;
+		while (!q.pop(f))
+			this_thread::yield();
+		return f;
+	}
+
+	static inline double seconds(chrono::steady_clock::duration d)
+	{
+		return chrono::duration<double>(d).count();
+	}
+
+public:
+	FramePipeline(const Mesh& mesh, const Shader& shader, int width, int height,
+					int depth = 3, JobSystem* jobs = nullptr) :
+		mesh(mesh), raster(shader), depth(min(max(depth, 1), max_depth)), jobs(jobs)
+	{
+		raster.set_view(width, height);
+		raster.set_jobs(jobs);
+
+		for (int i = 0; i < this->depth; ++i) {
+			frames.emplace_back(new Frame{shader, {}, Framebuffer(width, height)});
+			free_frames.push(frames.back().get());
+		}
+	}
+
+	template<typename Update, typename Present>
+	inline stats run(unsigned count, Update&& update, Present&& present)
+	{
+		return run(count, update, present, 0, [] (const stats&) {});
+	}
+
+	/*
+	 * Every window presented frames report(stats) is called on the calling
+	 * thread with the stats of just those frames. Stage times are summed
+	 * by the stage threads as they go, so a window's geometry and raster
+	 * times may include a frame or two still in flight.
+	 */
+	template<typename Update, typename Present, typename Report>
+	inline stats run(unsigned count, Update&& update, Present&& present,
+						unsigned window, Report&& report)
+	{
+		using clock = chrono::steady_clock;
+
+		atomic<clock::rep> tgeom(0), traster(0);
+		clock::duration tpresent{};
+
+		const clock::time_point start = clock::now();
+
+		thread geometry([&]
+		{
+			for (unsigned i = 0; !count || i < count; ++i) {
+				Frame* f = wait_pop(free_frames);
+				const clock::time_point t = clock::now();
+
+				update(i, f->shader);
+				pipeline::transform(f->shader, mesh, f->vout, jobs);
+
+				tgeom += (clock::now() - t).count();
+				while (!transformed.push(f))
+					this_thread::yield();
+			}
+		});
+
+		thread rasterizer([&]
+		{
+			for (unsigned i = 0; !count || i < count; ++i) {
+				Frame* f = wait_pop(transformed);
+				const clock::time_point t = clock::now();
+
+				raster.shader = f->shader;
+				raster.clear();
+				f->color.clear();
+				raster.draw(mesh, f->vout, f->color);
+
+				traster += (clock::now() - t).count();
+				while (!rastered.push(f))
+					this_thread::yield();
+			}
+		});
+
+		clock::time_point wstart = start;
+		clock::rep wgeom = 0, wraster = 0;
+		clock::duration wpresent{};
+
+		for (unsigned i = 0; !count || i < count; ++i) {
+			Frame* f = wait_pop(rastered);
+			const clock::time_point t = clock::now();
+
+			present(static_cast<const Framebuffer&>(f->color));
+
+			tpresent += clock::now() - t;
+			while (!free_frames.push(f))
+				this_thread::yield();
+
+			if (window && (i + 1) % window == 0) {
+				const clock::time_point now = clock::now();
+				const clock::rep g = tgeom, r = traster;
+
+				report(stats{window, seconds(now - wstart),
+					seconds(clock::duration(g - wgeom)),
+					seconds(clock::duration(r - wraster)),
+					seconds(tpresent - wpresent)});
+
+				wstart = now;
+				wgeom = g;
+				wraster = r;
+				wpresent = tpresent;
+			}
+		}
+
+		geometry.join();
+		rasterizer.join();
+
+		return {count, seconds(clock::now() - start),
+				seconds(clock::duration(tgeom.load())),
+				seconds(clock::duration(traster.load())), seconds(tpresent)};
+	}
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+extern "C"
+{
+	#include <sys/mman.h>
+}
+
+using namespace std;
+
+/*
+ * Page-backed memory for large, long-lived buffers. Explicit huge pages
+ * (MAP_HUGETLB) are tried first; they only exist if the administrator
+ * reserved some. Otherwise the mapping is aligned to 2 MiB and offered to
+ * transparent huge pages with madvise, which the kernel may or may not
+ * honour. Either way the memory comes zeroed.
+ */
+class HugePages
+{
+public:
+	enum backing {
+		none,
+		small,		// plain 4 KiB pages
+		transparent,	// madvise(MADV_HUGEPAGE) accepted
+		hugetlb		// reserved 2 MiB pages
+	};
+
+	static constexpr size_t hugesize = 2u << 20;
+
+private:
+	void* base;
+	size_t mapped;
+
+	void* ptr;
+	size_t bytes;
+	backing kind;
+
+	inline void release()
+	{
+		if (base)
+			munmap(base, mapped);
+
+		base = ptr = nullptr;
+		mapped = bytes = 0;
+		kind = none;
+	}
+
+public:
+	HugePages() : base(nullptr), mapped(0), ptr(nullptr), bytes(0), kind(none)
+	{
+	}
+
+	explicit HugePages(size_t size) : HugePages()
+	{
+		allocate(size);
+	}
+
+	HugePages(const HugePages&) = delete;
+	HugePages& operator=(const HugePages&) = delete;
+
+	HugePages(HugePages&& o) : HugePages()
+	{
+		*this = move(o);
+	}
+
+	HugePages& operator=(HugePages&& o)
+	{
+		swap(base, o.base);
+		swap(mapped, o.mapped);
+		swap(ptr, o.ptr);
+		swap(bytes, o.bytes);
+		swap(kind, o.kind);
+		return *this;
+	}
+
+	~HugePages()
+	{
+		release();
+	}
+
+	// Drops the old contents; false only if no memory could be mapped
+	inline bool allocate(size_t size)
+	{
+		release();
+
+		if (!size)
+			return true;
+
+		const size_t rounded = (size + hugesize - 1) & ~(hugesize - 1);
+		const int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+		void* p = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+
+		if (p != MAP_FAILED) {
+			base = ptr = p;
+			mapped = rounded;
+			bytes = size;
+			kind = hugetlb;
+			return true;
+		}
+
+		// one spare huge page to align the start
+		p = mmap(nullptr, rounded + hugesize, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+		if (p == MAP_FAILED)
+			return false;
+
+		base = p;
+		mapped = rounded + hugesize;
+		ptr = reinterpret_cast<void*>(
+			(reinterpret_cast<uintptr_t>(p) + hugesize - 1) & ~(hugesize - 1));
+		bytes = size;
+
+		kind = madvise(ptr, rounded, MADV_HUGEPAGE) == 0 ? transparent : small;
+
+		return true;
+	}
+
+	inline void* data() const { return ptr; }
+	inline size_t size() const { return bytes; }
+	inline backing kind_of() const { return kind; }
+
+	inline const char* name() const
+	{
+		switch (kind) {
+			case hugetlb: return "hugetlb";
+			case transparent: return "thp";
+			case small: return "4k";
+			default: return "none";
+		}
+	}
+};
@@ -0,0 +1,595 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <new>
+#include <utility>
+#include <type_traits>
+#include <algorithm>
+#include <cstdio>
+
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+
+struct JobOptions
+{
+	unsigned threads = max(1u, thread::hardware_concurrency()) - 1;
+	bool pin = false;	// bind every worker to a single cpu
+	bool numa = false;	// spread workers over NUMA nodes, bind each to its node
+};
+
+/*
+ * Work-stealing task system. Each worker owns a deque: it pushes and pops
+ * at the back, idle workers steal from the front of the others. Threads
+ * that are not workers (main, frame pipeline stages) run tasks too while
+ * they wait. Jobs and queue slots are pooled, so a steady workload does
+ * not allocate.
+ */
+class JobSystem
+{
+private:
+	struct Job
+	{
+		static constexpr size_t capacity = 64;
+
+		alignas(max_align_t) unsigned char storage[capacity];
+		void (*call)(void*);
+		void (*destroy)(void*);
+
+		atomic<int> refs;
+		atomic<int> pending;
+		atomic<bool> done;
+
+		mutex lock;
+		vector<Job*> dependents;
+	};
+
+	struct Queue
+	{
+		mutex lock;
+		vector<Job*> ring;
+		size_t head;
+		atomic<size_t> count;
+
+		Queue() : ring(256), head(0), count(0)
+		{
+		}
+
+		inline void push(Job* j)
+		{
+			lock_guard<mutex> guard(lock);
+
+			const size_t n = count.load(memory_order_relaxed);
+
+			if (n == ring.size()) {
+				vector<Job*> grown(ring.size() * 2);
+				for (size_t i = 0; i < n; ++i)
+					grown[i] = ring[(head + i) & (ring.size() - 1)];
+				ring.swap(grown);
+				head = 0;
+			}
+
+			ring[(head + n) & (ring.size() - 1)] = j;
+			count.store(n + 1, memory_order_release);
+		}
+
+		inline Job* pop_back()
+		{
+			if (!count.load(memory_order_acquire))
+				return nullptr;
+
+			lock_guard<mutex> guard(lock);
+
+			const size_t n = count.load(memory_order_relaxed);
+			if (!n)
+				return nullptr;
+
+			count.store(n - 1, memory_order_relaxed);
+			return ring[(head + n - 1) & (ring.size() - 1)];
+		}
+
+		inline Job* pop_front()
+		{
+			if (!count.load(memory_order_acquire))
+				return nullptr;
+
+			lock_guard<mutex> guard(lock);
+
+			const size_t n = count.load(memory_order_relaxed);
+			if (!n)
+				return nullptr;
+
+			Job* j = ring[head];
+			head = (head + 1) & (ring.size() - 1);
+			count.store(n - 1, memory_order_relaxed);
+			return j;
+		}
+	};
+
+	struct Worker
+	{
+		Queue queue;
+		thread th;
+
+		int node = 0;
+		int cpu = -1;
+
+		atomic<size_t> tasks{0};
+		atomic<size_t> steals{0};
+		atomic<int64_t> busy{0};
+	};
+
+	struct Current
+	{
+		const JobSystem* owner;
+		int index;
+	};
+
+	static inline Current& current()
+	{
+		static thread_local Current c = {nullptr, -1};
+		return c;
+	}
+
+	// workers[0..n-1] are threads, workers[n] collects jobs from outside
+	vector<unique_ptr<Worker>> workers;
+	size_t nthreads;
+
+	atomic<bool> stopping;
+	atomic<size_t> queued;
+	atomic<size_t> submitted;
+
+	mutex sleep_lock;
+	condition_variable sleep_cv;
+
+	mutex pool_lock;
+	vector<unique_ptr<Job>> jobs;
+	vector<Job*> pool;
+
+	chrono::steady_clock::time_point epoch;
+
+	inline int self() const
+	{
+		const Current& c = current();
+		return c.owner == this ? c.index : static_cast<int>(nthreads);
+	}
+
+	inline Job* acquire()
+	{
+		lock_guard<mutex> guard(pool_lock);
+
+		if (pool.empty()) {
+			jobs.emplace_back(new Job);
+			pool.push_back(jobs.back().get());
+		}
+
+		Job* j = pool.back();
+		pool.pop_back();
+
+		j->refs.store(1, memory_order_relaxed);
+		j->pending.store(1, memory_order_relaxed);
+		j->done.store(false, memory_order_relaxed);
+		return j;
+	}
+
+	inline void release(Job* j)
+	{
+		if (j->refs.fetch_sub(1, memory_order_acq_rel) != 1)
+			return;
+
+		lock_guard<mutex> guard(pool_lock);
+		pool.push_back(j);
+	}
+
+	inline void enqueue(Job* j)
+	{
+		j->refs.fetch_add(1, memory_order_relaxed);
+
+		const int s = self();
+		const int target = s < static_cast<int>(nthreads) ? s :
+			static_cast<int>(submitted.fetch_add(1, memory_order_relaxed) % (nthreads + 1));
+
+		workers[target]->queue.push(j);
+		queued.fetch_add(1, memory_order_release);
+
+		{
+			lock_guard<mutex> guard(sleep_lock);
+		}
+		sleep_cv.notify_one();
+	}
+
+	template<typename F>
+	inline Job* make(F&& fn)
+	{
+		using callable = typename decay<F>::type;
+
+		static_assert(sizeof(callable) <= Job::capacity,
+						"job captures too much, capture by reference");
+		static_assert(alignof(callable) <= alignof(max_align_t),
+						"job capture is overaligned");
+
+		Job* j = acquire();
+
+		new (j->storage) callable(std::forward<F>(fn));
+		j->call = [] (void* p) { (*static_cast<callable*>(p))(); };
+		j->destroy = [] (void* p) { static_cast<callable*>(p)->~callable(); };
+
+		return j;
+	}
+
+	inline void finish(Job* j)
+	{
+		lock_guard<mutex> guard(j->lock);
+
+		j->done.store(true, memory_order_release);
+
+		for (Job* d: j->dependents) {
+			if (d->pending.fetch_sub(1, memory_order_acq_rel) == 1)
+				enqueue(d);
+			release(d);
+		}
+
+		j->dependents.clear();
+	}
+
+	inline void execute(Job* j, Worker& w)
+	{
+		const auto start = chrono::steady_clock::now();
+
+		j->call(j->storage);
+		j->destroy(j->storage);
+
+		w.busy.fetch_add(chrono::duration_cast<chrono::nanoseconds>(
+			chrono::steady_clock::now() - start).count(), memory_order_relaxed);
+		w.tasks.fetch_add(1, memory_order_relaxed);
+
+		finish(j);
+		release(j);
+	}
+
+	// Runs one queued job if there is any, own queue first
+	inline bool run_one(int index)
+	{
+		Worker& w = *workers[index];
+
+		Job* j = w.queue.pop_back();
+
+		for (size_t k = 1; !j && k <= nthreads; ++k) {
+			const size_t victim = (index + k) % (nthreads + 1);
+			j = workers[victim]->queue.pop_front();
+
+			if (j)
+				w.steals.fetch_add(1, memory_order_relaxed);
+		}
+
+		if (!j)
+			return false;
+
+		queued.fetch_sub(1, memory_order_relaxed);
+		execute(j, w);
+		return true;
+	}
+
+	inline void worker_loop(int index)
+	{
+		current() = {this, index};
+
+		Worker& w = *workers[index];
+
+		if (w.cpu >= 0 || !node_cpus(w.node).empty())
+			bind_thread(w);
+
+		while (!stopping.load(memory_order_acquire)) {
+			if (run_one(index))
+				continue;
+
+			unique_lock<mutex> guard(sleep_lock);
+			sleep_cv.wait_for(guard, chrono::milliseconds(10), [this]
+			{
+				return queued.load(memory_order_acquire) ||
+						stopping.load(memory_order_acquire);
+			});
+		}
+	}
+
+	static inline vector<int> parse_cpulist(const string& list)
+	{
+		vector<int> cpus;
+		stringstream in(list);
+		string range;
+
+		while (getline(in, range, ',')) {
+			int first, last;
+			const int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+
+			if (n == 1)
+				cpus.push_back(first);
+			else if (n == 2)
+				for (int c = first; c <= last; ++c)
+					cpus.push_back(c);
+		}
+
+		return cpus;
+	}
+
+	static inline vector<vector<int>> numa_nodes()
+	{
+		vector<vector<int>> nodes;
+
+		for (int n = 0; ; ++n) {
+			ifstream in("/sys/devices/system/node/node" + to_string(n) + "/cpulist");
+			string list;
+
+			if (!in.is_open() || !getline(in, list))
+				break;
+
+			nodes.push_back(parse_cpulist(list));
+		}
+
+		return nodes;
+	}
+
+	vector<vector<int>> nodes;
+	bool numa_bind;
+
+	inline vector<int> node_cpus(int node) const
+	{
+		return numa_bind && node < static_cast<int>(nodes.size()) ?
+				nodes[node] : vector<int>();
+	}
+
+	inline void bind_thread(const Worker& w) const
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+
+		if (w.cpu >= 0)
+			CPU_SET(w.cpu, &set);
+		else
+			for (int c: node_cpus(w.node))
+				CPU_SET(c, &set);
+
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+
+public:
+	struct worker_stats {
+		size_t tasks;
+		size_t steals;
+		double busy;
+		double utilization;
+		int node;
+		int cpu;
+	};
+
+	// Refcounted reference to a submitted job, used for waits and dependencies
+	class handle
+	{
+		friend class JobSystem;
+
+		JobSystem* owner;
+		Job* job;
+
+		handle(JobSystem* owner, Job* job) : owner(owner), job(job)
+		{
+		}
+
+	public:
+		handle() : owner(nullptr), job(nullptr)
+		{
+		}
+
+		handle(const handle& other) : owner(other.owner), job(other.job)
+		{
+			if (job)
+				job->refs.fetch_add(1, memory_order_relaxed);
+		}
+
+		handle& operator=(handle other)
+		{
+			swap(owner, other.owner);
+			swap(job, other.job);
+			return *this;
+		}
+
+		~handle()
+		{
+			if (job)
+				owner->release(job);
+		}
+
+		bool done() const
+		{
+			return !job || job->done.load(memory_order_acquire);
+		}
+	};
+
+	JobSystem(const JobOptions& opts = JobOptions()) :
+		nthreads(opts.threads), stopping(false), queued(0), submitted(0),
+		epoch(chrono::steady_clock::now()), numa_bind(opts.numa)
+	{
+		const int hw = max(1u, thread::hardware_concurrency());
+
+		nodes = numa_nodes();
+		if (nodes.empty()) {
+			nodes.emplace_back();
+			for (int c = 0; c < hw; ++c)
+				nodes.back().push_back(c);
+		}
+
+		for (size_t i = 0; i <= nthreads; ++i) {
+			workers.emplace_back(new Worker);
+
+			Worker& w = *workers.back();
+
+			if (i == nthreads)
+				break;
+
+			if (opts.numa) {
+				w.node = i % nodes.size();
+
+				const vector<int>& cpus = nodes[w.node];
+				if (opts.pin && !cpus.empty())
+					w.cpu = cpus[(i / nodes.size()) % cpus.size()];
+			}
+			else if (opts.pin)
+				w.cpu = i % hw;
+		}
+
+		for (size_t i = 0; i < nthreads; ++i)
+			workers[i]->th = thread(&JobSystem::worker_loop, this, static_cast<int>(i));
+	}
+
+	JobSystem(const JobSystem&) = delete;
+
+	~JobSystem()
+	{
+		stopping.store(true, memory_order_release);
+
+		{
+			lock_guard<mutex> guard(sleep_lock);
+		}
+		sleep_cv.notify_all();
+
+		for (size_t i = 0; i < nthreads; ++i)
+			workers[i]->th.join();
+
+		// run whatever was left so captured state is destroyed properly
+		while (run_one(nthreads)) {}
+	}
+
+	inline size_t threads() const
+	{
+		return nthreads;
+	}
+
+	// Schedules fn() once every job in deps has finished
+	template<typename F>
+	inline handle submit(F&& fn, initializer_list<handle> deps = {})
+	{
+		Job* j = make(std::forward<F>(fn));
+
+		for (const handle& d: deps) {
+			if (!d.job)
+				continue;
+
+			lock_guard<mutex> guard(d.job->lock);
+
+			if (d.job->done.load(memory_order_relaxed))
+				continue;
+
+			j->refs.fetch_add(1, memory_order_relaxed);
+			j->pending.fetch_add(1, memory_order_relaxed);
+			d.job->dependents.push_back(j);
+		}
+
+		handle h(this, j);
+
+		if (j->pending.fetch_sub(1, memory_order_acq_rel) == 1)
+			enqueue(j);
+
+		return h;
+	}
+
+	// Runs other jobs on the calling thread until h has finished
+	inline void wait(const handle& h)
+	{
+		const int s = self();
+
+		while (!h.done())
+			if (!run_one(s))
+				this_thread::yield();
+	}
+
+	/*
+	 * Calls fn(first, last) over [begin, end) in chunks of at most grain
+	 * items and returns when all of them are done. The calling thread
+	 * takes the first chunk itself.
+	 */
+	template<typename F>
+	inline void parallel_for(size_t begin, size_t end, size_t grain, F&& fn)
+	{
+		if (end <= begin)
+			return;
+
+		grain = max<size_t>(grain, 1);
+
+		const size_t chunks = (end - begin + grain - 1) / grain;
+
+		if (chunks == 1 || !nthreads) {
+			for (size_t b = begin; b < end; b += grain)
+				fn(b, min(end, b + grain));
+			return;
+		}
+
+		atomic<size_t> remaining(chunks - 1);
+
+		for (size_t c = 1; c < chunks; ++c) {
+			const size_t b = begin + c * grain;
+			const size_t e = min(end, b + grain);
+
+			Job* j = make([&fn, &remaining, b, e]
+			{
+				fn(b, e);
+				remaining.fetch_sub(1, memory_order_release);
+			});
+
+			j->pending.store(0, memory_order_relaxed);
+			j->refs.store(0, memory_order_relaxed);
+			enqueue(j);
+		}
+
+		fn(begin, min(end, begin + grain));
+
+		const int s = self();
+
+		while (remaining.load(memory_order_acquire))
+			if (!run_one(s))
+				this_thread::yield();
+	}
+
+	// One entry per worker thread, the last one is for outside threads
+	inline vector<worker_stats> stats() const
+	{
+		const double wall = chrono::duration<double>(
+			chrono::steady_clock::now() - epoch).count();
+
+		vector<worker_stats> retval;
+
+		for (const unique_ptr<Worker>& w: workers) {
+			const double busy = w->busy.load(memory_order_relaxed) * 1e-9;
+
+			retval.push_back({
+				w->tasks.load(memory_order_relaxed),
+				w->steals.load(memory_order_relaxed),
+				busy,
+				wall > 0 ? busy / wall : 0.,
+				w->node,
+				w->cpu
+			});
+		}
+
+		return retval;
+	}
+
+	inline void reset_stats()
+	{
+		for (unique_ptr<Worker>& w: workers) {
+			w->tasks.store(0, memory_order_relaxed);
+			w->steals.store(0, memory_order_relaxed);
+			w->busy.store(0, memory_order_relaxed);
+		}
+
+		epoch = chrono::steady_clock::now();
+	}
+};
@@ -1,6 +1,7 @@
 #pragma once
 #include <cmath>
 #include <cassert>
+#include <cstdint>
 #include <type_traits>
 
 template<typename T, int n>
@@ -0,0 +1,258 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <utility>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+#include "linalg.hpp"
+#include "wfobj.hpp"
+
+// Segment in viewport pixel coordinates, y pointing up
+struct segment_t
+{
+    vec2f dots[2];
+};
+
+/*
+ * Liang-Barsky clip against [0, w - 1] x [0, h - 1].
+ * Returns false when nothing of the segment is left.
+ */
+inline bool clip_segment(segment_t& s, float w, float h)
+{
+    const vec2f d = s.dots[1] - s.dots[0];
+
+    float t0 = 0.f;
+    float t1 = 1.f;
+
+    const float p[4] = {-d.x, d.x, -d.y, d.y};
+    const float q[4] = {
+        s.dots[0].x,
+        w - 1.f - s.dots[0].x,
+        s.dots[0].y,
+        h - 1.f - s.dots[0].y
+    };
+
+    for (int i = 0; i < 4; ++i) {
+        if (p[i] == 0.f) {
+            if (q[i] < 0.f)
+                return false;
+            continue;
+        }
+
+        const float t = q[i] / p[i];
+
+        if (p[i] < 0.f)
+            t0 = std::max(t0, t);
+        else
+            t1 = std::min(t1, t);
+
+        if (t0 > t1)
+            return false;
+    }
+
+    const vec2f a = s.dots[0];
+
+    s.dots[0] = a + d * t0;
+    s.dots[1] = a + d * t1;
+
+    return true;
+}
+
+/*
+ * Clips a clip-space segment to the near plane. In this renderer w is the
+ * view-space z, negative in front of the camera, and the near plane is
+ * where z / w == -1, so the visible side is z + w <= 0.
+ */
+inline bool clip_near(vec4f& a, vec4f& b)
+{
+    const float da = -(a.z + a.w);
+    const float db = -(b.z + b.w);
+
+    if (da < 0.f && db < 0.f)
+        return false;
+
+    if (da < 0.f)
+        a = a + (b - a) * (da / (da - db));
+    else if (db < 0.f)
+        b = b + (a - b) * (db / (db - da));
+
+    return true;
+}
+
+/*
+ * Integer Bresenham straight into a bottom-up, row-major buffer of
+ * w x h pixels. Endpoints must already be inside the buffer.
+ */
+inline void draw_line(bgracolor_t* pixels, int w, int h,
+                        int x0, int y0, int x1, int y1,
+                        const bgracolor_t& color)
+{
+    int dx = x1 - x0;
+    int dy = y1 - y0;
+
+    // row stride is negative because row 0 is at the bottom
+    const int sx = dx < 0 ? -1 : 1;
+    const int sy = dy < 0 ? w : -w;
+
+    dx = std::abs(dx);
+    dy = std::abs(dy);
+
+    bgracolor_t* p = pixels + w * (h - 1 - y0) + x0;
+
+    if (dx >= dy) {
+        int err = 2 * dy - dx;
+        for (int i = 0; i <= dx; ++i) {
+            *p = color;
+            if (err > 0) {
+                p += sy;
+                err -= 2 * dx;
+            }
+            p += sx;
+            err += 2 * dy;
+        }
+    }
+    else {
+        int err = 2 * dx - dy;
+        for (int i = 0; i <= dy; ++i) {
+            *p = color;
+            if (err > 0) {
+                p += sx;
+                err -= 2 * dy;
+            }
+            p += sy;
+            err += 2 * dx;
+        }
+    }
+}
+
+// Clips and draws a batch into any target with data(), width(), height()
+template<typename Target>
+inline void draw_segments(Target& target, const segment_t* segs, size_t count,
+                            const bgracolor_t& color)
+{
+    const int w = target.width();
+    const int h = target.height();
+
+    bgracolor_t* const pixels = target.data();
+
+    for (size_t i = 0; i < count; ++i) {
+        segment_t s = segs[i];
+
+        if (!clip_segment(s, w, h))
+            continue;
+
+        draw_line(pixels, w, h,
+                    std::lround(s.dots[0].x), std::lround(s.dots[0].y),
+                    std::lround(s.dots[1].x), std::lround(s.dots[1].y),
+                    color);
+    }
+}
+
+/*
+ * Unique edges of the mesh as index pairs. .obj faces get their own
+ * vertices, so corners are first merged by position; every edge shared
+ * by two triangles is then kept once.
+ */
+inline std::vector<std::pair<Mesh::uint, Mesh::uint>> mesh_edges(const Mesh& mesh)
+{
+    struct poshash {
+        size_t operator()(const vec3f& p) const
+        {
+            uint32_t b[3];
+            memcpy(b, p.data, sizeof(b));
+            return (b[0] * 73856093u) ^ (b[1] * 19349663u) ^ (b[2] * 83492791u);
+        }
+    };
+
+    struct poseq {
+        bool operator()(const vec3f& a, const vec3f& b) const
+        {
+            return !memcmp(a.data, b.data, sizeof(a.data));
+        }
+    };
+
+    std::unordered_map<vec3f, Mesh::uint, poshash, poseq> first;
+    std::vector<Mesh::uint> canon(mesh.verts.size());
+
+    for (size_t i = 0; i < mesh.verts.size(); ++i)
+        canon[i] = first.emplace(mesh.verts[i].pos, i).first->second;
+
+    std::vector<std::pair<Mesh::uint, Mesh::uint>> edges;
+    edges.reserve(mesh.inds.size());
+
+    for (size_t i = 0; i + 2 < mesh.inds.size(); i += 3)
+        for (int k = 0; k < 3; ++k) {
+            Mesh::uint a = canon[mesh.inds[i + k]];
+            Mesh::uint b = canon[mesh.inds[i + (k + 1) % 3]];
+
+            if (a == b)
+                continue;
+
+            edges.emplace_back(std::min(a, b), std::max(a, b));
+        }
+
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    return edges;
+}
+
+/*
+ * Wireframe overlay for a mesh drawn with a Pipeline: project(pos) gives
+ * the clip-space position, as the shaders' Camera::project does. Edges
+ * are near-clipped in clip space, then go through draw_segments.
+ */
+class Wireframe
+{
+private:
+    std::vector<std::pair<Mesh::uint, Mesh::uint>> edges;
+    std::vector<vec4f> clip;
+    std::vector<segment_t> segs;
+
+public:
+    // No edges; draw() does nothing until one is built from a mesh
+    Wireframe() = default;
+
+    Wireframe(const Mesh& mesh) : edges(mesh_edges(mesh))
+    {
+    }
+
+    size_t edge_count() const
+    {
+        return edges.size();
+    }
+
+    template<typename Project, typename Target>
+    void draw(const Mesh& mesh, Project&& project, Target& target,
+                const bgracolor_t& color)
+    {
+        const float hw = target.width() * 0.5f;
+        const float hh = target.height() * 0.5f;
+
+        clip.resize(mesh.verts.size());
+        for (size_t i = 0; i < mesh.verts.size(); ++i)
+            clip[i] = project(mesh.verts[i].pos);
+
+        segs.clear();
+
+        for (const auto& e: edges) {
+            vec4f a = clip[e.first];
+            vec4f b = clip[e.second];
+
+            if (!clip_near(a, b))
+                continue;
+
+            // same pixel-center mapping as Rasterizer
+            segs.push_back({{
+                {(a.x / a.w + 1.f) * hw - 0.5f, (a.y / a.w + 1.f) * hh - 0.5f},
+                {(b.x / b.w + 1.f) * hw - 0.5f, (b.y / b.w + 1.f) * hh - 0.5f}
+            }});
+        }
+
+        draw_segments(target, segs.data(), segs.size(), color);
+    }
+};
@@ -1,125 +1,547 @@
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
 
 #include "xwindow.hpp"
-#include "rasterizer.hpp"
+#include "pipeline.hpp"
+#include "framepipe.hpp"
+#include "lines.hpp"
+#include "packed.hpp"
+#include "arena.hpp"
+#include "dynres.hpp"
+#include "batch.hpp"
+#include "temporal.hpp"
+#include "stream.hpp"
+#include "shadow.hpp"
+#include "tiled.hpp"
+#include "shaders.hpp"
 #include "wfobj.hpp"
 
-Mesh::vertex get_mixed(const Mesh::vertex vs[3], const float b, const float c)
+struct Options
 {
-	const float a = 1.f - b - c;
+	int samples = 1;
+	int pipeline = 0;
+	bool wireframe = false;
+	bool packed = false;
+	bool temporal = false;
+	bool shadows = false;
+	bool tiled = false;
+	const char* stream = nullptr;
+	bool dynamic = false;
+	const char* dynres_log = nullptr;
+	DynResOptions dynres;
+	const char* mesh = "air.obj";
+	bool batch = false;
+	const char* poses = nullptr;
+	unsigned turntable = 0;
+	int width = 512;
+	int height = 512;
+	const char* out = "view";
+	JobOptions jobs;
+};
+
+static Options parse_options(int argc, char** argv)
+{
+	Options opts;
+	
+	for (int i = 1; i < argc; ++i) {
+		const bool has_value = i + 1 < argc;
+		
+		if (!strcmp(argv[i], "--msaa") && has_value)
+			opts.samples = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--pipeline") && has_value)
+			opts.pipeline = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && has_value)
+			opts.jobs.threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--pin"))
+			opts.jobs.pin = true;
+		else if (!strcmp(argv[i], "--numa"))
+			opts.jobs.numa = true;
+		else if (!strcmp(argv[i], "--wireframe"))
+			opts.wireframe = true;
+		else if (!strcmp(argv[i], "--packed"))
+			opts.packed = true;
+		else if (!strcmp(argv[i], "--temporal"))
+			opts.temporal = true;
+		else if (!strcmp(argv[i], "--tiled"))
+			opts.tiled = true;
+		else if (!strcmp(argv[i], "--shadows"))
+			opts.shadows = true;
+		else if (!strcmp(argv[i], "--stream") && has_value)
+			opts.stream = argv[++i];
+		else if (!strcmp(argv[i], "--dynres") && has_value) {
+			opts.dynamic = true;
+			opts.dynres.budget_ms = atof(argv[++i]);
+		}
+		else if (!strcmp(argv[i], "--dynres-min") && has_value)
+			opts.dynres.min_scale = atof(argv[++i]);
+		else if (!strcmp(argv[i], "--dynres-log") && has_value)
+			opts.dynres_log = argv[++i];
+		else if (!strcmp(argv[i], "--mesh") && has_value)
+			opts.mesh = argv[++i];
+		else if (!strcmp(argv[i], "--batch"))
+			opts.batch = true;
+		else if (!strcmp(argv[i], "--poses") && has_value)
+			opts.poses = argv[++i];
+		else if (!strcmp(argv[i], "--turntable") && has_value)
+			opts.turntable = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--size") && has_value) {
+			if (sscanf(argv[++i], "%dx%d", &opts.width, &opts.height) != 2 
+				|| opts.width <= 0 || opts.height <= 0)
+				throw std::invalid_argument("size must be WxH");
+		}
+		else if (!strcmp(argv[i], "--out") && has_value)
+			opts.out = argv[++i];
+		else
+			throw std::invalid_argument("unknown option " + std::string(argv[i]));
+	}
+	
+	return opts;
+}
+
+static void set_camera(Camera& cam, float phi, float theta)
+{
+	const vec3f dir = {
+		cos(theta) * sin(phi),
+		sin(theta),
+		cos(theta) * cos(phi)
+	};
 	
-	Mesh::vertex retval = {};
+	cam.rotater = rotate(dir, {0.f, 0.f, 1.f});
+	cam.campos = dir * 10.f;
+}
+
+static void step_camera(Camera& cam, float& phi, float& theta)
+{
+	phi += 0.01;
+	theta += 0.01;
+	
+	set_camera(cam, phi, theta);
+}
+
+template<int N>
+static void run_msaa(const Mesh& mesh, XWindow& xw, Pipeline<LambertShader>& pipe)
+{
+	MSAATarget<N> target;
+	target.resize(xw.width(), xw.height());
+	
+	float phi = 1.57f;
+	float theta = 0.f;
+	
+	for (unsigned frame = 0; ; ++frame) {
+		target.clear();
+		
+		step_camera(pipe.shader.cam, phi, theta);
+		
+		pipe.draw(mesh, target);
+		target.resolve(xw);
+		
+		if (frame % 100 == 0)
+			cerr << "msaa " << N << "x: " 
+				<< target.memory_usage() / 1024 << " KiB used, "
+				<< target.uncompressed_usage() / 1024 << " KiB uncompressed, "
+				<< target.expanded() << " expanded pixels" << endl;
+		
+		xw.update();
+	}
+}
+
+/*
+ * Renders at the scale the controller picks to hold the frame budget and
+ * upscales into the window. Every decision can go to a CSV log.
+ */
+template<typename Geometry>
+static void run_dynres(const Geometry& mesh, XWindow& xw, Pipeline<LambertShader>& pipe,
+						ArenaSet& arenas, const Options& opts)
+{
+	using clock = chrono::steady_clock;
+	
+	ResolutionController control(opts.dynres);
+	Upscaler upscale;
+	
+	// full size up front, so changing the scale never reallocates
+	Framebuffer color(xw.width(), xw.height());
+	
+	std::ofstream log;
+	if (opts.dynres_log) {
+		log.open(opts.dynres_log);
+		log << "frame,ms,avg_ms,scale,width,height" << endl;
+	}
 	
-	const float* v0 = reinterpret_cast<const float *>(vs + 0);
-	const float* v1 = reinterpret_cast<const float *>(vs + 1);
-	const float* v2 = reinterpret_cast<const float *>(vs + 2);
+	float phi = 1.57f;
+	float theta = 0.f;
 	
-	float* r = reinterpret_cast<float *>(&retval);
+	clock::time_point last = clock::now();
 	
-	for (int i = 0; i < sizeof(Mesh::vertex) / sizeof(float); ++i)
-		r[i] = a * v0[i] + b * v1[i] + c * v2[i];
+	for (unsigned frame = 1; ; ++frame) {
+		const int w = control.width(xw.width());
+		const int h = control.height(xw.height());
+		
+		if (w != color.width() || h != color.height()) {
+			color.resize(w, h);
+			pipe.set_view(w, h);
+		}
+		
+		color.clear();
+		pipe.clear();
+		
+		step_camera(pipe.shader.cam, phi, theta);
+		
+		pipe.draw(mesh, color);
+		
+		if (w == xw.width() && h == xw.height())
+			memcpy(xw.data(), color.data(), w * h * sizeof(bgracolor_t));
+		else
+			upscale(color, xw);
+		
+		xw.update();
+		arenas.reset();
+		
+		const clock::time_point now = clock::now();
+		const double ms = chrono::duration<double, milli>(now - last).count();
+		last = now;
+		
+		const auto d = control.update(ms);
 		
-	return retval;
+		if (log.is_open())
+			log << d.frame << "," << d.ms << "," << d.avg_ms << "," << d.scale << ","
+				<< w << "," << h << "\n";
+		
+		if (d.changed)
+			cerr << "dynres: frame " << d.frame << ", " << d.avg_ms << " ms average for "
+				<< opts.dynres.budget_ms << " ms budget, scale " << d.scale << " ("
+				<< control.width(xw.width()) << "x" << control.height(xw.height()) << ")" << endl;
+	}
 }
 
-int main() {
-	Mesh mesh = import_obj("air.obj");
+/*
+ * Directional light from a fixed world direction with a shadow map,
+ * rendered depth-only from the light every frame before the main pass.
+ */
+template<typename Geometry>
+static void run_shadows(const Geometry& mesh, const Bounds& bounds, XWindow& xw,
+						const Camera& cam, ArenaSet& arenas, JobSystem& jobs)
+{
+	using clock = chrono::steady_clock;
+	
+	const vec3f light = (vec3f{-0.8f, 0.6f, 0.6f}).normalized();
+	
+	ShadowMap map;
+	map.set_jobs(&jobs);
+	map.fit(light, bounds.center, bounds.radius);
+	
+	Pipeline<ShadowShader> pipe;
+	pipe.set_jobs(&jobs);
+	pipe.set_arenas(&arenas);
+	pipe.set_view(xw.width(), xw.height());
 	
-	const vec3f move = {-2.f, -3.f, -2.f};
-	const vec3f light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	pipe.shader.cam = cam;
+	pipe.shader.light = light;
+	pipe.shader.color = {0.5f, 0.2f, 1.f};
+	pipe.shader.shadows = &map;
+	
+	float phi = 1.57f;
+	float theta = 0.f;
+	
+	double shadow = 0., main = 0.;
+	unsigned renders = 0;
+	
+	for (unsigned frame = 1; ; ++frame) {
+		xw.clear();
+		pipe.clear();
+		
+		step_camera(pipe.shader.cam, phi, theta);
+		
+		// only the camera moves, so the map is rendered once after fit()
+		clock::time_point start = clock::now();
+		if (map.update(mesh)) {
+			shadow += chrono::duration<double, milli>(clock::now() - start).count();
+			++renders;
+		}
+		
+		start = clock::now();
+		pipe.draw(mesh, xw);
+		main += chrono::duration<double, milli>(clock::now() - start).count();
+		
+		xw.update();
+		arenas.reset();
+		
+		if (frame % 100 == 0) {
+			cerr << "shadows: " << renders << " map renders";
+			if (renders)
+				cerr << " at " << shadow / renders << " ms";
+			cerr << ", " << main / 100 << " ms main pass" << endl;
+			
+			shadow = main = 0.;
+			renders = 0;
+		}
+	}
+}
+
+/*
+ * Headless: every view of --poses or --turntable goes to its own raw
+ * rgba file, rendered in parallel over the job system.
+ */
+template<typename Geometry>
+static int run_batch(const Geometry& mesh, const Bounds& bounds, 
+						const Options& opts, JobSystem& jobs)
+{
+	std::vector<View> views;
+	
+	if (opts.poses)
+		views = read_poses(opts.poses);
+	if (opts.turntable) {
+		auto const turn = turntable(bounds, opts.turntable);
+		views.insert(views.end(), turn.begin(), turn.end());
+	}
+	
+	if (views.empty()) {
+		cerr << "batch: no views, use --poses FILE or --turntable N" << endl;
+		return 1;
+	}
+	
+	LambertShader shader;
+	shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	shader.color = {0.5f, 0.2f, 1.f};
+	
+	BatchRenderer batch(shader, bounds, opts.width, opts.height, &jobs);
+	
+	auto const stats = batch.run(mesh, views, opts.out);
+	
+	cerr << "batch: " << stats.views << " views of " << opts.width << "x" << opts.height
+		<< " in " << stats.seconds << " s, " << stats.views / stats.seconds << " views/s, "
+		<< stats.workers << " workers, " << stats.worker_bytes / 1024 << " KiB per worker" << endl;
+	
+	if (stats.failed) {
+		cerr << "batch: " << stats.failed << " views could not be written to " 
+			<< opts.out << "NNNN.rgba" << endl;
+		return 1;
+	}
+	
+	return 0;
+}
+
+static void print_job_stats(JobSystem& jobs)
+{
+	auto const stats = jobs.stats();
+	
+	for (size_t i = 0; i < stats.size(); ++i)
+		cerr << (i < jobs.threads() ? "worker " + to_string(i) : std::string("outside"))
+			<< ": " << stats[i].tasks << " tasks, "
+			<< stats[i].steals << " steals, "
+			<< 100. * stats[i].utilization << "% busy" << endl;
+	
+	jobs.reset_stats();
+}
+
+static void run_pipelined(const Mesh& mesh, XWindow& xw, const LambertShader& shader, 
+							int depth, JobSystem& jobs)
+{
+	FramePipeline<LambertShader> frames(mesh, shader, xw.width(), xw.height(), depth, &jobs);
+	
+	const size_t bytes = xw.width() * xw.height() * sizeof(bgracolor_t);
+	
+	// one run for good, so the stages never drain; stats come per 100 frames
+	frames.run(0,
+		[] (unsigned i, LambertShader& s)
+		{
+			const float t = 0.01f * (i + 1);
+			set_camera(s.cam, 1.57f + t, t);
+		},
+		[&xw, bytes] (const Framebuffer& fb)
+		{
+			memcpy(xw.data(), fb.data(), bytes);
+			xw.update();
+		},
+		100,
+		[depth, &jobs] (const FramePipeline<LambertShader>::stats& stats)
+		{
+			cerr << "pipeline depth " << depth << ": " 
+				<< stats.frames / stats.seconds << " fps, stage ms/frame"
+				<< " geometry " << 1e3 * stats.geometry / stats.frames
+				<< " raster " << 1e3 * stats.raster / stats.frames
+				<< " present " << 1e3 * stats.present / stats.frames << endl;
+			
+			print_job_stats(jobs);
+		});
+}
+
+int main(int argc, char** argv) {
+	const Options opts = parse_options(argc, argv);
+	
+	JobSystem jobs(opts.jobs);
+	
+	Mesh mesh = import_obj(opts.mesh, &jobs);
+	PackedMesh packed;
+	
+	if (opts.packed) {
+		packed = pack_mesh(mesh, &jobs);
+		
+		const pack_error err = measure_error(mesh, packed);
+		
+		cerr << "packed mesh: " << mesh.verts.size() * sizeof(Mesh::vertex) / 1024 
+			<< " KiB -> " << packed.verts.size() * sizeof(PackedMesh::vertex) / 1024 
+			<< " KiB vertices, max error pos " << err.pos << " (bound " << err.pos_bound 
+			<< "), norm " << err.norm << " deg, tex " << err.tex << endl;
+	}
+	
+	if (opts.batch) {
+		const Bounds bounds = mesh_bounds(mesh);
+		
+		return opts.packed ? run_batch(packed, bounds, opts, jobs) 
+							: run_batch(mesh, bounds, opts, jobs);
+	}
 	
 	XWindow xw;
-	Rasterizer rast;
+	ArenaSet arenas;
+	Pipeline<LambertShader> pipe;
+	pipe.set_jobs(&jobs);
+	pipe.set_arenas(&arenas);
 	
 	const int w = xw.width();
 	const int h = xw.height();
 	
-	const float ratio = static_cast<float>(w) / h;
+	pipe.set_view(w, h);
 	
-	rast.set_view(0, 0, w, h);
+	LambertShader& shader = pipe.shader;
 	
-	float const near = 0.5f;
-    float const far  = 25.f;
-    
-    float const c1 = (far + near) / (far - near);
-    float const c2 = 2.f * near * far / (far - near);
+	shader.cam.move = {-2.f, -3.f, -2.f};
+	shader.cam.set_projection(static_cast<float>(w) / h, 0.5f, 25.f);
+	
+	shader.light = (vec3f{0.f, 0.f, 1.f}).normalized();
+	shader.color = {0.5f, 0.2f, 1.f};
+	
+	if (opts.pipeline > 0)
+		run_pipelined(mesh, xw, shader, opts.pipeline, jobs);
+	
+	if (opts.shadows) {
+		const Bounds bounds = mesh_bounds(mesh);
 		
-	vector<Rasterizer::rastout> rout;
+		if (opts.packed)
+			run_shadows(packed, bounds, xw, shader.cam, arenas, jobs);
+		else
+			run_shadows(mesh, bounds, xw, shader.cam, arenas, jobs);
+	}
+	
+	if (opts.dynamic) {
+		if (opts.packed)
+			run_dynres(packed, xw, pipe, arenas, opts);
+		else
+			run_dynres(mesh, xw, pipe, arenas, opts);
+	}
+	
+	switch (opts.samples) {
+		case 1: break;
+		case 2: run_msaa<2>(mesh, xw, pipe); break;
+		case 4: run_msaa<4>(mesh, xw, pipe); break;
+		case 8: run_msaa<8>(mesh, xw, pipe); break;
+		default:
+			cerr << "unsupported sample count " << opts.samples << endl;
+			return 1;
+	}
+	
+	Wireframe wf = opts.wireframe ? Wireframe(mesh) : Wireframe();
+	
+	// reused colors must not depend on the view, so the cache lights in world space
+	Pipeline<WorldLambertShader> world;
+	TemporalCache<WorldLambertShader> cache;
+	if (opts.temporal) {
+		world.set_jobs(&jobs);
+		world.set_arenas(&arenas);
+		world.set_view(w, h);
+		world.shader.light = shader.light;
+		world.shader.color = shader.color;
+		cache.resize(w, h);
+	}
+	
+	std::unique_ptr<StreamServer> stream;
+	if (opts.stream)
+		stream.reset(new StreamServer(opts.stream, w, h));
+	
+	const auto project = [&shader] (const vec3f& pos) 
+	{ 
+		return shader.cam.project(pos); 
+	};
 	
 	float phi = 1.57f;
 	float theta = 0.f;
 	
-	vector<float> depth;
+	TiledFramebuffer tiled(opts.tiled ? w : 0, opts.tiled ? h : 0);
 	
-	while (1) {
-		xw.clear();
+	// everything but the wireframe goes through the tiled buffer if asked to
+	const auto draw = [&] (auto& target)
+	{
+		if (opts.temporal) {
+			world.shader.cam = shader.cam;
+			world.clear();
+		}
+		
+		if (opts.temporal && opts.packed)
+			cache.draw(world, packed, target);
+		else if (opts.temporal)
+			cache.draw(world, mesh, target);
+		else if (opts.packed)
+			pipe.draw(packed, target);
+		else
+			pipe.draw(mesh, target);
+	};
+	
+	for (unsigned frame = 1; ; ++frame) {
+		pipe.clear();
 		
-		phi += 0.01;
-		theta += 0.01;
+		step_camera(shader.cam, phi, theta);
 		
-		depth.assign(w * h, 1.f); 
+		if (opts.tiled) {
+			tiled.clear();
+			draw(tiled);
+			tiled.present(xw.data(), &jobs);
+		}
+		else {
+			xw.clear();
+			draw(xw);
+		}
 		
-		const vec3f dir = {
-			cos(theta) * sin(phi),
-			sin(theta),
-			cos(theta) * cos(phi)
-		};
+		if (opts.wireframe)
+			wf.draw(mesh, project, xw, {255u, 255u, 255u, 255u});
 		
-		const sqmat3f rotater = rotate(dir, {0.f, 0.f, 1.f});
+		if (stream)
+			stream->submit(xw.data());
 		
-		const vec3f campos = dir * 10.f;
+		xw.update();
 		
-		for (int i = 0; i < mesh.inds.size(); i += 3) {
-			Mesh::vertex vs[3] = {
-				mesh.verts[mesh.inds[i]],
-				mesh.verts[mesh.inds[i + 1]],
-				mesh.verts[mesh.inds[i + 2]]
-			};
-			
-			vec4f p[3];
+		arenas.reset();
+		
+		if (frame % 100 == 0) {
+			print_job_stats(jobs);
+			cerr << "frame arenas: " << arenas.high_water() / 1024 << " KiB high water, "
+				<< arenas.capacity() / 1024 << " KiB reserved" << endl;
 			
-			for (int j = 0; j < 3; ++j) {
-				const vec3f r = rotater * (vs[j].pos + move - campos);
+			if (opts.temporal) {
+				auto const& t = cache.total();
 				
-				p[j].x = -r.x / ratio;
-				p[j].y = -r.y;
-				p[j].z = c1 * r.z + c2;
-				p[j].w = r.z;
+				cerr << "temporal: " << 100. * t.hit_rate() << "% reused, " 
+					<< t.shaded() / 100 << " of " << t.covered / 100 << " pixels shaded per frame ("
+					<< t.disoccluded / 100 << " disoccluded, " << t.refreshed / 100 << " refreshed)" << endl;
+				
+				cache.reset_total();
 			}
 			
-			rast.rasterize(p, rout);
-			
-			//cout << rout.size() << endl;
-			
-			for (auto o: rout) {
-				//cout << o.x << " " << o.y << endl;
-				
-				if (depth[w * o.y + o.x] < o.depth || o.depth < -1.f)
-					continue;
+			if (stream) {
+				auto const s = stream->get_stats();
 				
-				depth[w * o.y + o.x] = o.depth;
+				cerr << "stream: " << s.sent << " of " << s.submitted << " frames sent, "
+					<< s.dropped << " dropped, " << s.idle << " without viewer";
+				if (s.sent)
+					cerr << ", " << s.bytes / s.sent / 1024 << " KiB and " 
+						<< s.tiles / s.sent << " tiles per frame, "
+						<< 1e3 * s.encode / s.sent << " ms encode";
+				cerr << endl;
 				
-				Mesh::vertex vo = get_mixed(vs, o.b, o.c);
-				
-				const vec3f lcolor = {0.5f, 0.2f, 1.f};
-				
-				const float nlight = max(0.f, light * (rotater * vo.norm));
-				
-				const vec3f color = lcolor * nlight;
-				
-				xw[{o.x, o.y}] = { 	
-					static_cast<uint8_t>(color.x * 255u), 
-					static_cast<uint8_t>(color.y * 255u),
-					static_cast<uint8_t>(color.z * 255u),
-					255u
-				};
+				stream->reset_stats();
 			}
-			
-			rout.clear();
 		}
-		
-		xw.update();
 	}
-	
-	while (1) {}
 }
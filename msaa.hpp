@@ -0,0 +1,238 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "linalg.hpp"
+#include "rasterizer.hpp"
+
+using namespace std;
+
+// Rotated-grid sample positions in pixels, relative to the pixel center
+template<int N>
+struct SamplePattern;
+
+template<>
+struct SamplePattern<2>
+{
+	static constexpr int count = 2;
+	static constexpr float offsets[2][2] = {
+		{ 0.25f,  0.25f}, {-0.25f, -0.25f}
+	};
+};
+
+template<>
+struct SamplePattern<4>
+{
+	static constexpr int count = 4;
+	static constexpr float offsets[4][2] = {
+		{-0.125f, -0.375f}, { 0.375f, -0.125f},
+		{-0.375f,  0.125f}, { 0.125f,  0.375f}
+	};
+};
+
+template<>
+struct SamplePattern<8>
+{
+	static constexpr int count = 8;
+	static constexpr float offsets[8][2] = {
+		{ 0.0625f, -0.1875f}, {-0.0625f,  0.1875f},
+		{ 0.3125f,  0.0625f}, {-0.1875f, -0.3125f},
+		{-0.3125f,  0.3125f}, {-0.4375f, -0.0625f},
+		{ 0.1875f,  0.4375f}, { 0.4375f, -0.4375f}
+	};
+};
+
+/*
+ * Multisampled render target: per-sample depth, one shaded color per
+ * pixel. Pixels whose samples all hold the same color keep just that
+ * color; only partially covered pixels get a block of N sample colors
+ * from the pool.
+ */
+template<int N>
+class MSAATarget
+{
+public:
+	using pattern = SamplePattern<N>;
+	using fragment = Rasterizer::msaaout<N>;
+
+	static constexpr unsigned full = (1u << N) - 1;
+	static constexpr uint32_t compressed = ~0u;
+
+private:
+	int w, h;
+
+	vector<float> depth;
+	vector<bgracolor_t> color;
+	vector<uint32_t> slot;
+
+	vector<bgracolor_t> pool;
+	vector<uint32_t> freeslots;
+
+	bgracolor_t clearcolor;
+
+	inline void release(int p)
+	{
+		if (slot[p] != compressed) {
+			freeslots.push_back(slot[p]);
+			slot[p] = compressed;
+		}
+	}
+
+	inline bgracolor_t* expand(int p)
+	{
+		if (slot[p] == compressed) {
+			if (!freeslots.empty()) {
+				slot[p] = freeslots.back();
+				freeslots.pop_back();
+			}
+			else {
+				slot[p] = pool.size() / N;
+				pool.resize(pool.size() + N);
+			}
+
+			bgracolor_t* s = &pool[slot[p] * N];
+			for (int i = 0; i < N; ++i)
+				s[i] = color[p];
+
+			return s;
+		}
+
+		return &pool[slot[p] * N];
+	}
+
+	static inline bgracolor_t average(const bgracolor_t* s)
+	{
+#ifdef __SSE2__
+		const __m128i zero = _mm_setzero_si128();
+
+		__m128i sum = zero;
+		for (int i = 0; i < N; i += 2) {
+			__m128i two = _mm_loadl_epi64(
+				reinterpret_cast<const __m128i *>(s + i));
+			sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(two, zero));
+		}
+
+		sum = _mm_add_epi16(sum, _mm_srli_si128(sum, 8));
+		sum = _mm_add_epi16(sum, _mm_set1_epi16(N / 2));
+
+		switch (N) {
+			case 2: sum = _mm_srli_epi16(sum, 1); break;
+			case 4: sum = _mm_srli_epi16(sum, 2); break;
+			case 8: sum = _mm_srli_epi16(sum, 3); break;
+		}
+
+		const int packed = _mm_cvtsi128_si32(_mm_packus_epi16(sum, zero));
+
+		bgracolor_t retval;
+		memcpy(&retval, &packed, sizeof(retval));
+		return retval;
+#else
+		unsigned sum[4] = {N / 2, N / 2, N / 2, N / 2};
+		for (int i = 0; i < N; ++i)
+			for (int k = 0; k < 4; ++k)
+				sum[k] += s[i][k];
+
+		return {
+			static_cast<uint8_t>(sum[0] / N),
+			static_cast<uint8_t>(sum[1] / N),
+			static_cast<uint8_t>(sum[2] / N),
+			static_cast<uint8_t>(sum[3] / N)
+		};
+#endif
+	}
+
+public:
+	MSAATarget() : w(0), h(0), clearcolor{0, 0, 0, 255}
+	{
+	}
+
+	inline void resize(int width, int height)
+	{
+		w = width;
+		h = height;
+
+		clear();
+	}
+
+	inline void clear(const bgracolor_t& c = {0, 0, 0, 255})
+	{
+		clearcolor = c;
+
+		depth.assign(w * h * N, 1.f);
+		color.assign(w * h, c);
+		slot.assign(w * h, compressed);
+
+		pool.clear();
+		freeslots.clear();
+	}
+
+	// Depth-tests the covered samples, returns the mask of passing ones
+	inline unsigned test(const fragment& o)
+	{
+		float* d = &depth[(w * o.y + o.x) * N];
+
+		unsigned pass = 0;
+		for (int s = 0; s < N; ++s)
+			if ((o.mask >> s & 1u) && d[s] >= o.depth[s] && o.depth[s] >= -1.f) {
+				d[s] = o.depth[s];
+				pass |= 1u << s;
+			}
+
+		return pass;
+	}
+
+	inline void write(const fragment& o, unsigned pass, const bgracolor_t& c)
+	{
+		const int p = w * o.y + o.x;
+
+		if (pass == full) {
+			release(p);
+			color[p] = c;
+			return;
+		}
+
+		bgracolor_t* s = expand(p);
+		for (int i = 0; i < N; ++i)
+			if (pass >> i & 1u)
+				s[i] = c;
+	}
+
+	template<typename Target>
+	inline void resolve(Target& target) const
+	{
+		for (int y = 0; y < h; ++y)
+			for (int x = 0; x < w; ++x) {
+				const int p = w * y + x;
+
+				target[{x, y}] = slot[p] == compressed ?
+					color[p] : average(&pool[slot[p] * N]);
+			}
+	}
+
+	inline size_t expanded() const
+	{
+		return pool.size() / N - freeslots.size();
+	}
+
+	inline size_t memory_usage() const
+	{
+		return depth.capacity() * sizeof(float) +
+				color.capacity() * sizeof(bgracolor_t) +
+				slot.capacity() * sizeof(uint32_t) +
+				pool.capacity() * sizeof(bgracolor_t) +
+				freeslots.capacity() * sizeof(uint32_t);
+	}
+
+	// What the same buffer would take with every pixel stored per-sample
+	inline size_t uncompressed_usage() const
+	{
+		return static_cast<size_t>(w) * h * N *
+				(sizeof(float) + sizeof(bgracolor_t));
+	}
+};
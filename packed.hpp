@@ -0,0 +1,385 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#include "linalg.hpp"
+#include "jobs.hpp"
+#include "wfobj.hpp"
+
+using namespace std;
+
+inline uint16_t float_to_half(float f)
+{
+	uint32_t x;
+	memcpy(&x, &f, sizeof(x));
+
+	const uint16_t sign = x >> 16 & 0x8000u;
+	x &= 0x7fffffffu;
+
+	// too large for a half, infinity or nan
+	if (x >= 0x47800000u)
+		return sign | (x > 0x7f800000u ? 0x7e00u : 0x7c00u);
+
+	// below 2^-14 the half is denormal, its unit is 2^-24
+	if (x < 0x38800000u)
+		return sign | static_cast<uint16_t>(lrintf(fabsf(f) * 16777216.f));
+
+	// rebias the exponent, round the mantissa to nearest even
+	x -= 0x38000000u;
+	x += 0xfffu + (x >> 13 & 1u);
+
+	return sign | x >> 13;
+}
+
+inline float half_to_float(uint16_t h)
+{
+	const uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+	const uint32_t em = h & 0x7fffu;
+
+	uint32_t x;
+
+	if (em >= 0x7c00u)
+		x = 0x7f800000u | (em & 0x3ffu) << 13;
+	else if (em >= 0x400u)
+		x = (em << 13) + 0x38000000u;
+	else {
+		const float f = em * (1.f / 16777216.f);
+		memcpy(&x, &f, sizeof(x));
+	}
+
+	x |= sign;
+
+	float f;
+	memcpy(&f, &x, sizeof(f));
+	return f;
+}
+
+/*
+ * Octahedral unit vector: projected onto |x| + |y| + |z| = 1, the lower
+ * half folded over the diagonals, stored as two snorm16.
+ */
+inline void oct_encode(const vec3f& n, int16_t out[2])
+{
+	const float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+
+	float x = l1 > 0.f ? n.x / l1 : 0.f;
+	float y = l1 > 0.f ? n.y / l1 : 0.f;
+
+	if (n.z < 0.f) {
+		const float ox = x;
+		x = (1.f - fabsf(y)) * (x >= 0.f ? 1.f : -1.f);
+		y = (1.f - fabsf(ox)) * (y >= 0.f ? 1.f : -1.f);
+	}
+
+	out[0] = static_cast<int16_t>(lroundf(min(max(x, -1.f), 1.f) * 32767.f));
+	out[1] = static_cast<int16_t>(lroundf(min(max(y, -1.f), 1.f) * 32767.f));
+}
+
+inline vec3f oct_decode(int16_t qx, int16_t qy)
+{
+	float x = qx * (1.f / 32767.f);
+	float y = qy * (1.f / 32767.f);
+
+	const float z = 1.f - fabsf(x) - fabsf(y);
+	const float t = max(-z, 0.f);
+
+	x += x >= 0.f ? -t : t;
+	y += y >= 0.f ? -t : t;
+
+	return (vec3f{x, y, z}).normalized();
+}
+
+/*
+ * Mesh with 16-byte vertices instead of 32: positions quantized to 16 bits
+ * over the bounding box, octahedral normals and half-float texture
+ * coordinates. Pipeline decodes them in the vertex stage.
+ */
+struct PackedMesh
+{
+	struct vertex
+	{
+		uint16_t pos[3];
+		uint16_t pad;
+		int16_t norm[2];
+		uint16_t tex[2];
+	};
+
+	vec3f origin;	// bounding box minimum
+	vec3f scale;	// bounding box extent / 65535
+
+	std::vector<vertex> verts;
+	std::vector<Mesh::uint> inds;
+
+	inline size_t memory_usage() const
+	{
+		return verts.capacity() * sizeof(vertex) + inds.capacity() * sizeof(Mesh::uint);
+	}
+};
+
+// Largest differences to the source mesh, norm in degrees
+struct pack_error
+{
+	float pos, pos_bound;
+	float norm;
+	float tex;
+};
+
+inline Mesh::vertex unpack_vertex(const PackedMesh& mesh, const PackedMesh::vertex& v)
+{
+	Mesh::vertex retval;
+
+	for (int k = 0; k < 3; ++k)
+		retval.pos[k] = mesh.origin[k] + v.pos[k] * mesh.scale[k];
+
+	retval.tex = {half_to_float(v.tex[0]), half_to_float(v.tex[1])};
+	retval.norm = oct_decode(v.norm[0], v.norm[1]);
+
+	return retval;
+}
+
+#ifdef __SSE2__
+// Low 16 bits of every lane as a half
+static inline __m128 half_to_float4(__m128i h)
+{
+#ifdef __F16C__
+	h = _mm_shufflelo_epi16(h, _MM_SHUFFLE(3, 3, 2, 0));
+	h = _mm_shufflehi_epi16(h, _MM_SHUFFLE(3, 3, 2, 0));
+	return _mm_cvtph_ps(_mm_shuffle_epi32(h, _MM_SHUFFLE(3, 3, 2, 0)));
+#else
+	// rebias the exponent; a denormal half gets the implicit one added and
+	// subtracted again in float, which is exact. Finite values only.
+	const __m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+	const __m128i bits = _mm_add_epi32(_mm_slli_epi32(
+		_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13), _mm_set1_epi32(0x38000000));
+
+	const __m128 denormal = _mm_castsi128_ps(_mm_cmpeq_epi32(
+		_mm_and_si128(h, _mm_set1_epi32(0x7c00)), _mm_setzero_si128()));
+
+	const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(0x38800000));
+	const __m128 fixed = _mm_sub_ps(_mm_castsi128_ps(
+		_mm_add_epi32(bits, _mm_set1_epi32(0x00800000))), magic);
+
+	const __m128 f = _mm_or_ps(_mm_and_ps(denormal, fixed),
+								_mm_andnot_ps(denormal, _mm_castsi128_ps(bits)));
+
+	return _mm_or_ps(f, _mm_castsi128_ps(sign));
+#endif
+}
+#endif
+
+/*
+ * Decodes count vertices starting at first. With SSE2 four vertices go at
+ * once: a 4x4 transpose splits them into position, normal and texture
+ * lanes, another two put the results back in Mesh::vertex order.
+ */
+inline void unpack_vertices(const PackedMesh& mesh, size_t first, size_t count,
+							Mesh::vertex* out)
+{
+	static_assert(sizeof(PackedMesh::vertex) == 16, "packed vertex must be 16 bytes");
+	static_assert(sizeof(Mesh::vertex) == 8 * sizeof(float), "unexpected vertex layout");
+
+	const PackedMesh::vertex* in = mesh.verts.data() + first;
+
+	size_t i = 0;
+
+#ifdef __SSE2__
+	const __m128i low = _mm_set1_epi32(0xffff);
+
+	const __m128 sx = _mm_set1_ps(mesh.scale.x);
+	const __m128 sy = _mm_set1_ps(mesh.scale.y);
+	const __m128 sz = _mm_set1_ps(mesh.scale.z);
+
+	const __m128 ox = _mm_set1_ps(mesh.origin.x);
+	const __m128 oy = _mm_set1_ps(mesh.origin.y);
+	const __m128 oz = _mm_set1_ps(mesh.origin.z);
+
+	const __m128 snorm = _mm_set1_ps(1.f / 32767.f);
+	const __m128 one = _mm_set1_ps(1.f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 signbit = _mm_set1_ps(-0.f);
+
+	for (; i + 4 <= count; i += 4) {
+		const __m128i* src = reinterpret_cast<const __m128i*>(in + i);
+
+		__m128 r0 = _mm_castsi128_ps(_mm_loadu_si128(src));
+		__m128 r1 = _mm_castsi128_ps(_mm_loadu_si128(src + 1));
+		__m128 r2 = _mm_castsi128_ps(_mm_loadu_si128(src + 2));
+		__m128 r3 = _mm_castsi128_ps(_mm_loadu_si128(src + 3));
+
+		// pos x|y, pos z|pad, norm x|y, tex u|v of each vertex
+		_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+
+		const __m128i pxy = _mm_castps_si128(r0);
+		const __m128i pzw = _mm_castps_si128(r1);
+		const __m128i nxy = _mm_castps_si128(r2);
+		const __m128i tuv = _mm_castps_si128(r3);
+
+		__m128 px = _mm_cvtepi32_ps(_mm_and_si128(pxy, low));
+		__m128 py = _mm_cvtepi32_ps(_mm_srli_epi32(pxy, 16));
+		__m128 pz = _mm_cvtepi32_ps(_mm_and_si128(pzw, low));
+
+		px = _mm_add_ps(_mm_mul_ps(px, sx), ox);
+		py = _mm_add_ps(_mm_mul_ps(py, sy), oy);
+		pz = _mm_add_ps(_mm_mul_ps(pz, sz), oz);
+
+		__m128 nx = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_slli_epi32(nxy, 16), 16));
+		__m128 ny = _mm_cvtepi32_ps(_mm_srai_epi32(nxy, 16));
+
+		nx = _mm_mul_ps(nx, snorm);
+		ny = _mm_mul_ps(ny, snorm);
+
+		__m128 nz = _mm_sub_ps(one, _mm_add_ps(_mm_andnot_ps(signbit, nx),
+												_mm_andnot_ps(signbit, ny)));
+
+		// unfold the lower half: x -= copysign(max(-z, 0), x)
+		const __m128 t = _mm_max_ps(_mm_sub_ps(zero, nz), zero);
+
+		nx = _mm_sub_ps(nx, _mm_or_ps(t, _mm_and_ps(nx, signbit)));
+		ny = _mm_sub_ps(ny, _mm_or_ps(t, _mm_and_ps(ny, signbit)));
+
+		const __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz))));
+
+		nx = _mm_mul_ps(nx, inv);
+		ny = _mm_mul_ps(ny, inv);
+		nz = _mm_mul_ps(nz, inv);
+
+		__m128 tu = half_to_float4(_mm_and_si128(tuv, low));
+		__m128 tv = half_to_float4(_mm_srli_epi32(tuv, 16));
+
+		_MM_TRANSPOSE4_PS(px, py, pz, tu);
+		_MM_TRANSPOSE4_PS(tv, nx, ny, nz);
+
+		float* dst = reinterpret_cast<float*>(out + i);
+
+		_mm_storeu_ps(dst, px);
+		_mm_storeu_ps(dst + 4, tv);
+		_mm_storeu_ps(dst + 8, py);
+		_mm_storeu_ps(dst + 12, nx);
+		_mm_storeu_ps(dst + 16, pz);
+		_mm_storeu_ps(dst + 20, ny);
+		_mm_storeu_ps(dst + 24, tu);
+		_mm_storeu_ps(dst + 28, nz);
+	}
+#endif
+
+	for (; i < count; ++i)
+		out[i] = unpack_vertex(mesh, in[i]);
+}
+
+inline PackedMesh pack_mesh(const Mesh& mesh, JobSystem* jobs = nullptr)
+{
+	PackedMesh out;
+
+	vec3f lo = {0.f, 0.f, 0.f};
+	vec3f hi = {0.f, 0.f, 0.f};
+
+	if (!mesh.verts.empty())
+		lo = hi = mesh.verts[0].pos;
+
+	for (const Mesh::vertex& v: mesh.verts)
+		for (int k = 0; k < 3; ++k) {
+			lo[k] = min(lo[k], v.pos[k]);
+			hi[k] = max(hi[k], v.pos[k]);
+		}
+
+	vec3f inv;
+
+	for (int k = 0; k < 3; ++k) {
+		const float extent = hi[k] - lo[k];
+
+		out.scale[k] = extent / 65535.f;
+		inv[k] = extent > 0.f ? 65535.f / extent : 0.f;
+	}
+
+	out.origin = lo;
+	out.verts.resize(mesh.verts.size());
+	out.inds = mesh.inds;
+
+	auto const pack = [&] (size_t first, size_t last)
+	{
+		for (size_t i = first; i < last; ++i) {
+			const Mesh::vertex& v = mesh.verts[i];
+			PackedMesh::vertex& p = out.verts[i];
+
+			for (int k = 0; k < 3; ++k) {
+				const long q = lroundf((v.pos[k] - lo[k]) * inv[k]);
+				p.pos[k] = static_cast<uint16_t>(min(max(q, 0l), 65535l));
+			}
+
+			p.pad = 0;
+			oct_encode(v.norm, p.norm);
+
+			p.tex[0] = float_to_half(v.tex.x);
+			p.tex[1] = float_to_half(v.tex.y);
+		}
+	};
+
+	if (jobs)
+		jobs->parallel_for(0, mesh.verts.size(), 4096, pack);
+	else
+		pack(0, mesh.verts.size());
+
+	return out;
+}
+
+inline PackedMesh import_obj_packed(char const* filename, JobSystem* jobs = nullptr)
+{
+	return pack_mesh(import_obj(filename, jobs), jobs);
+}
+
+/*
+ * Measured against the source mesh. Positions are off by at most half a
+ * quantization step per axis plus float rounding, which is pos_bound;
+ * normals and texture coordinates are only measured.
+ */
+inline pack_error measure_error(const Mesh& mesh, const PackedMesh& packed)
+{
+	// half a step, plus float rounding when the position is rebuilt
+	vec3f bound;
+	for (int k = 0; k < 3; ++k)
+		bound[k] = 0.5f * packed.scale[k]
+				+ (fabsf(packed.origin[k]) + 65535.f * packed.scale[k]) * FLT_EPSILON;
+
+	pack_error retval = {0.f, bound.length(), 0.f, 0.f};
+
+	Mesh::vertex buf[256];
+
+	for (size_t first = 0; first < packed.verts.size(); first += 256) {
+		const size_t count = min<size_t>(256, packed.verts.size() - first);
+
+		unpack_vertices(packed, first, count, buf);
+
+		for (size_t i = 0; i < count; ++i) {
+			const Mesh::vertex& a = mesh.verts[first + i];
+			const Mesh::vertex& b = buf[i];
+
+			retval.pos = max(retval.pos, (a.pos - b.pos).length());
+			retval.tex = max(retval.tex, max(fabsf(a.tex.x - b.tex.x),
+												fabsf(a.tex.y - b.tex.y)));
+
+			if (a.norm.length2() > 0.f) {
+				const vec3f n = a.norm.normalized();
+				const float angle = atan2f(cross(n, b.norm).length(), n * b.norm);
+
+				retval.norm = max(retval.norm, angle * 180.f / static_cast<float>(M_PI));
+			}
+		}
+	}
+
+	return retval;
+}
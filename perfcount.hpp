@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+extern "C"
+{
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+}
+
+using namespace std;
+
+/*
+ * Hardware counters of the calling thread, user space only, through
+ * perf_event_open. Every event is opened on its own, so one the CPU or
+ * the hypervisor does not offer leaves the others working; available()
+ * tells which ones count. Nothing is counted between start() and stop()
+ * on other threads.
+ */
+class PerfCounters
+{
+public:
+	enum event {
+		cache_refs,
+		cache_misses,
+		dtlb_load_misses,
+		dtlb_store_misses,
+		count
+	};
+
+	struct sample {
+		uint64_t value[count];
+	};
+
+private:
+	int fds[count];
+
+	static inline int open_event(uint32_t type, uint64_t config)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+
+		return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	static inline uint64_t tlb_miss(uint64_t op)
+	{
+		return PERF_COUNT_HW_CACHE_DTLB | op << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	}
+
+public:
+	PerfCounters()
+	{
+		fds[cache_refs] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_REFERENCES);
+		fds[cache_misses] = open_event(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+		fds[dtlb_load_misses] = open_event(PERF_TYPE_HW_CACHE, tlb_miss(PERF_COUNT_HW_CACHE_OP_READ));
+		fds[dtlb_store_misses] = open_event(PERF_TYPE_HW_CACHE, tlb_miss(PERF_COUNT_HW_CACHE_OP_WRITE));
+	}
+
+	PerfCounters(const PerfCounters&) = delete;
+
+	~PerfCounters()
+	{
+		for (int fd: fds)
+			if (fd >= 0)
+				close(fd);
+	}
+
+	static inline const char* name(event e)
+	{
+		static const char* const names[count] = {
+			"cache refs", "cache misses", "dTLB load misses", "dTLB store misses"
+		};
+
+		return names[e];
+	}
+
+	inline bool available(event e) const
+	{
+		return fds[e] >= 0;
+	}
+
+	inline bool any() const
+	{
+		for (int fd: fds)
+			if (fd >= 0)
+				return true;
+
+		return false;
+	}
+
+	inline void start()
+	{
+		for (int fd: fds)
+			if (fd >= 0) {
+				ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+			}
+	}
+
+	// Counts since start(); zero for events that are not available
+	inline sample stop()
+	{
+		sample s = {};
+
+		for (int e = 0; e < count; ++e)
+			if (fds[e] >= 0) {
+				ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+
+				if (read(fds[e], &s.value[e], sizeof(uint64_t)) != sizeof(uint64_t))
+					s.value[e] = 0;
+			}
+
+		return s;
+	}
+};
@@ -0,0 +1,509 @@
+#pragma once
+
+#include <vector>
+#include <type_traits>
+
+#include "linalg.hpp"
+#include "rasterizer.hpp"
+#include "msaa.hpp"
+#include "depth.hpp"
+#include "jobs.hpp"
+#include "arena.hpp"
+#include "wfobj.hpp"
+#include "packed.hpp"
+
+using namespace std;
+
+/*
+ * Shader is a plain struct with uniforms as members and
+ *
+ *     struct varyings { ... };  // floats only, interpolated per fragment
+ *     vec4f       vertex(const Mesh::vertex& in, varyings& out) const;
+ *     bgracolor_t fragment(const varyings& in) const;
+ *
+ * Pipeline<Shader> is instantiated per shader, so the whole per-fragment
+ * path is inlined: no virtual calls, no std::function. Meshes are either
+ * Mesh or PackedMesh; packed vertices are decoded to Mesh::vertex in the
+ * vertex stage, so shaders never see the difference.
+ */
+
+template<typename V>
+inline V mix_varyings(const V& v0, const V& v1, const V& v2,
+						const float b, const float c)
+{
+	static_assert(is_trivially_copyable<V>::value,
+					"varyings must be trivially copyable");
+	static_assert(is_empty<V>::value || sizeof(V) % sizeof(float) == 0,
+					"varyings must consist of floats");
+
+	if constexpr (is_empty<V>::value)
+		return V();
+
+	constexpr int n = sizeof(V) / sizeof(float);
+
+	const float a = 1.f - b - c;
+
+	V retval;
+
+	const float* f0 = reinterpret_cast<const float *>(&v0);
+	const float* f1 = reinterpret_cast<const float *>(&v1);
+	const float* f2 = reinterpret_cast<const float *>(&v2);
+
+	float* r = reinterpret_cast<float *>(&retval);
+
+	for (int i = 0; i < n; ++i)
+		r[i] = a * f0[i] + b * f1[i] + c * f2[i];
+
+	return retval;
+}
+
+template<typename Shader, DepthFormat F = DepthFormat::float32>
+class Pipeline
+{
+public:
+	using varyings = typename Shader::varyings;
+
+	struct vertex_out {
+		vec4f pos;
+		varyings var;
+	};
+
+private:
+	Rasterizer rast;
+
+	int w, h;
+
+	DepthBuffer<F> depth;
+	vector<vertex_out> vout;
+	vector<vec4f> pout;
+
+	JobSystem* jobs;
+
+	// screen tiles drawn as separate jobs, a multiple of the depth tile
+	static constexpr int bintile = 64;
+	static constexpr size_t bingrain = 1024;
+
+	int binsx, binsy;
+
+	// per-frame scratch; own_arenas unless the frame loop provides a set
+	ArenaSet own_arenas;
+	ArenaSet* arenas;
+
+	// triangles of one chunk by tile: tris[start[tile] .. start[tile + 1])
+	struct chunkbins {
+		uint32_t* start;
+		uint32_t* tris;
+	};
+
+	struct tilerange {
+		int16_t x0, y0, x1, y1;
+	};
+
+	static inline const vec4f& position(const vertex_out& v) { return v.pos; }
+	static inline const vec4f& position(const vec4f& p) { return p; }
+
+	// Depth-tested fragments of one triangle, passed on as rastout
+	template<typename Fragment>
+	inline void raster_triangle(Rasterizer& r, const vec4f p[3], Fragment&& fragment)
+	{
+		bool accepted = false;
+
+		r.rasterize_blocks<DepthBuffer<F>::tilesize>(p,
+		[&] (int x0, int y0, bool full, const Rasterizer::zplane& plane)
+		{
+			const Rasterizer::blockmode mode =
+				depth.test_block(x0, y0, full, plane);
+
+			accepted = mode == Rasterizer::block_accept;
+			return mode;
+		},
+		[&] (const Rasterizer::rastout& o)
+		{
+			if (!accepted && !depth.test(o.x, o.y, o.depth))
+				return;
+
+			fragment(o);
+		});
+	}
+
+	// Depth test and write only
+	inline void depth_triangle(Rasterizer& r, const vec4f p[3])
+	{
+		r.rasterize_depth<DepthBuffer<F>::tilesize>(p,
+		[&] (int x0, int y0, bool full, const Rasterizer::zplane& plane)
+		{
+			return depth.test_block(x0, y0, full, plane);
+		},
+		[&] (int x, int y0, int y1, float z, float dzdy)
+		{
+			depth.test_column(x, y0, y1, z, dzdy);
+		});
+	}
+
+	template<typename Target>
+	inline void draw_triangle(Rasterizer& r, const vertex_out& v0,
+								const vertex_out& v1, const vertex_out& v2,
+								Target& target)
+	{
+		const vec4f p[3] = {v0.pos, v1.pos, v2.pos};
+
+		raster_triangle(r, p, [&] (const Rasterizer::rastout& o)
+		{
+			target[{o.x, o.y}] = shader.fragment(
+				mix_varyings(v0.var, v1.var, v2.var, o.b, o.c)
+			);
+		});
+	}
+
+	// Screen tile range touched by the triangle's bounding box
+	inline void tile_range(const vec4f p[3], int& tx0, int& ty0, int& tx1, int& ty1) const
+	{
+		auto const clamp = [] (float const x)
+		{
+			return x >= 1.f ? 1.f : (x <= -1.f ? -1.f : x);
+		};
+
+		float xmin = 1.f, xmax = -1.f, ymin = 1.f, ymax = -1.f;
+
+		for (int k = 0; k < 3; ++k) {
+			const float x = clamp(p[k].x / p[k].w);
+			const float y = clamp(p[k].y / p[k].w);
+
+			xmin = min(xmin, x);
+			xmax = max(xmax, x);
+			ymin = min(ymin, y);
+			ymax = max(ymax, y);
+		}
+
+		// one pixel of slack for the rasterizer's rounding
+		tx0 = max(0, static_cast<int>((xmin + 1.f) * 0.5f * w) - 1) / bintile;
+		ty0 = max(0, static_cast<int>((ymin + 1.f) * 0.5f * h) - 1) / bintile;
+		tx1 = min(w - 1, static_cast<int>((xmax + 1.f) * 0.5f * w) + 1) / bintile;
+		ty1 = min(h - 1, static_cast<int>((ymax + 1.f) * 0.5f * h) + 1) / bintile;
+	}
+
+	/*
+	 * Bins triangles to screen tiles in chunks of bingrain, then draws the
+	 * tiles in parallel. Each tile walks the chunks in order, so triangles
+	 * hit a pixel in submission order just like in the serial path. All
+	 * bins live in the frame arenas. Triangle is called as
+	 * triangle(rasterizer, index) with the tile's scissored rasterizer.
+	 * Vertices are vertex_out or bare positions.
+	 */
+	template<typename Geometry, typename Vertex, typename Triangle>
+	inline void draw_binned(const Geometry& mesh, const vector<Vertex>& transformed,
+							Triangle&& triangle)
+	{
+		if (arenas == &own_arenas)
+			own_arenas.reset();
+
+		const size_t ntris = mesh.inds.size() / 3;
+		const size_t nchunks = (ntris + bingrain - 1) / bingrain;
+		const int ntiles = binsx * binsy;
+
+		chunkbins* const bins = arenas->local().allocate<chunkbins>(nchunks);
+
+		jobs->parallel_for(0, nchunks, 1, [&] (size_t first, size_t last)
+		{
+			FrameArena& arena = arenas->local();
+
+			for (size_t c = first; c < last; ++c) {
+				const size_t begin = c * bingrain;
+				const size_t end = min(ntris, begin + bingrain);
+
+				tilerange* const ranges = arena.allocate<tilerange>(end - begin);
+				uint32_t* const start = arena.allocate<uint32_t>(ntiles + 1);
+				uint32_t* const cursor = arena.allocate<uint32_t>(ntiles);
+
+				fill(start, start + ntiles + 1, 0u);
+
+				for (size_t t = begin; t < end; ++t) {
+					const vec4f p[3] = {
+						position(transformed[mesh.inds[3 * t]]),
+						position(transformed[mesh.inds[3 * t + 1]]),
+						position(transformed[mesh.inds[3 * t + 2]])
+					};
+
+					int tx0, ty0, tx1, ty1;
+					tile_range(p, tx0, ty0, tx1, ty1);
+
+					ranges[t - begin] = {
+						static_cast<int16_t>(tx0), static_cast<int16_t>(ty0),
+						static_cast<int16_t>(tx1), static_cast<int16_t>(ty1)
+					};
+
+					for (int ty = ty0; ty <= ty1; ++ty)
+						for (int tx = tx0; tx <= tx1; ++tx)
+							++start[ty * binsx + tx + 1];
+				}
+
+				for (int i = 0; i < ntiles; ++i) {
+					start[i + 1] += start[i];
+					cursor[i] = start[i];
+				}
+
+				uint32_t* const tris = arena.allocate<uint32_t>(start[ntiles]);
+
+				for (size_t t = begin; t < end; ++t) {
+					const tilerange& r = ranges[t - begin];
+
+					for (int ty = r.y0; ty <= r.y1; ++ty)
+						for (int tx = r.x0; tx <= r.x1; ++tx)
+							tris[cursor[ty * binsx + tx]++] = t;
+				}
+
+				bins[c] = {start, tris};
+			}
+		});
+
+		jobs->parallel_for(0, ntiles, 1, [&] (size_t first, size_t last)
+		{
+			for (size_t tile = first; tile < last; ++tile) {
+				const int x0 = tile % binsx * bintile;
+				const int y0 = tile / binsx * bintile;
+
+				Rasterizer r = rast;
+				r.set_scissor(x0, y0, x0 + bintile - 1, y0 + bintile - 1);
+
+				for (size_t c = 0; c < nchunks; ++c)
+					for (uint32_t k = bins[c].start[tile]; k < bins[c].start[tile + 1]; ++k)
+						triangle(r, bins[c].tris[k]);
+			}
+		});
+	}
+
+	// Every triangle in order, binned over the job system if there is one
+	template<typename Geometry, typename Vertex, typename Triangle>
+	inline void raster_all(const Geometry& mesh, const vector<Vertex>& transformed,
+							Triangle&& triangle)
+	{
+		if (jobs && jobs->threads()) {
+			draw_binned(mesh, transformed, triangle);
+			return;
+		}
+
+		for (size_t t = 0; t < mesh.inds.size() / 3; ++t)
+			triangle(rast, t);
+	}
+
+	// fn(index, vertex) for every vertex, packed ones decoded a block at a time
+	template<typename Fn>
+	static inline void for_vertices(const Mesh& mesh, JobSystem* jobs, Fn&& fn)
+	{
+		auto const run = [&] (size_t first, size_t last)
+		{
+			for (size_t i = first; i < last; ++i)
+				fn(i, mesh.verts[i]);
+		};
+
+		if (jobs)
+			jobs->parallel_for(0, mesh.verts.size(), 4096, run);
+		else
+			run(0, mesh.verts.size());
+	}
+
+	template<typename Fn>
+	static inline void for_vertices(const PackedMesh& mesh, JobSystem* jobs, Fn&& fn)
+	{
+		auto const run = [&] (size_t first, size_t last)
+		{
+			constexpr size_t block = 64;
+			Mesh::vertex decoded[block];
+
+			for (size_t i = first; i < last; i += block) {
+				const size_t count = min(block, last - i);
+
+				unpack_vertices(mesh, i, count, decoded);
+
+				for (size_t k = 0; k < count; ++k)
+					fn(i + k, decoded[k]);
+			}
+		};
+
+		if (jobs)
+			jobs->parallel_for(0, mesh.verts.size(), 4096, run);
+		else
+			run(0, mesh.verts.size());
+	}
+
+public:
+	Shader shader;
+
+	// Vertex stage on its own, so it can run ahead of rasterization
+	template<typename Geometry>
+	static inline void transform(const Shader& shader, const Geometry& mesh,
+									vector<vertex_out>& out,
+									JobSystem* jobs = nullptr)
+	{
+		out.resize(mesh.verts.size());
+
+		for_vertices(mesh, jobs, [&] (size_t i, const Mesh::vertex& v)
+		{
+			out[i].pos = shader.vertex(v, out[i].var);
+		});
+	}
+
+	// Positions only; the varyings are never stored, so inlining drops them
+	template<typename Geometry>
+	static inline void transform_positions(const Shader& shader, const Geometry& mesh,
+											vector<vec4f>& out,
+											JobSystem* jobs = nullptr)
+	{
+		out.resize(mesh.verts.size());
+
+		for_vertices(mesh, jobs, [&] (size_t i, const Mesh::vertex& v)
+		{
+			varyings unused;
+			out[i] = shader.vertex(v, unused);
+		});
+	}
+
+	Pipeline(const Shader& shader = Shader()) :
+		w(0), h(0), jobs(nullptr), binsx(0), binsy(0), arenas(&own_arenas),
+		shader(shader)
+	{
+	}
+
+	inline void set_view(int width, int height)
+	{
+		w = width;
+		h = height;
+
+		rast.set_view(0, 0, w, h);
+		depth.resize(w, h);
+
+		binsx = (w + bintile - 1) / bintile;
+		binsy = (h + bintile - 1) / bintile;
+	}
+
+	// Spreads transform, binning and tile rasterization over the job system
+	inline void set_jobs(JobSystem* js)
+	{
+		jobs = js;
+	}
+
+	// Scratch memory shared with the rest of the frame, reset by its owner
+	inline void set_arenas(ArenaSet* set)
+	{
+		arenas = set ? set : &own_arenas;
+	}
+
+	inline void clear()
+	{
+		depth.clear();
+	}
+
+	inline const DepthBuffer<F>& depth_buffer() const
+	{
+		return depth;
+	}
+
+	inline size_t memory_usage() const
+	{
+		return depth.memory_usage() + vout.capacity() * sizeof(vertex_out)
+			+ pout.capacity() * sizeof(vec4f);
+	}
+
+	template<typename Geometry, typename Target>
+	inline void draw(const Geometry& mesh, Target& target)
+	{
+		transform(shader, mesh, vout, jobs);
+		draw(mesh, vout, target);
+	}
+
+	// Raster stage over vertices already transformed by transform()
+	template<typename Geometry, typename Target>
+	inline void draw(const Geometry& mesh, const vector<vertex_out>& transformed,
+						Target& target)
+	{
+		raster_all(mesh, transformed, [&] (Rasterizer& r, size_t t)
+		{
+			draw_triangle(r,
+				transformed[mesh.inds[3 * t]],
+				transformed[mesh.inds[3 * t + 1]],
+				transformed[mesh.inds[3 * t + 2]],
+				target);
+		});
+	}
+
+	/*
+	 * Depth only, for shadow maps and prepasses: positions are the only
+	 * vertex output, fragments are neither interpolated nor shaded.
+	 */
+	template<typename Geometry>
+	inline void draw_depth(const Geometry& mesh)
+	{
+		transform_positions(shader, mesh, pout, jobs);
+
+		raster_all(mesh, pout, [&] (Rasterizer& r, size_t t)
+		{
+			const vec4f p[3] = {
+				pout[mesh.inds[3 * t]],
+				pout[mesh.inds[3 * t + 1]],
+				pout[mesh.inds[3 * t + 2]]
+			};
+
+			depth_triangle(r, p);
+		});
+	}
+
+	/*
+	 * Fragment stage supplied per triangle: visible(triangle, v) is called
+	 * with the triangle's three transformed vertices and returns the
+	 * function called as fragment(o) for each of its fragments that pass
+	 * the depth test, so the last call for a pixel is its nearest
+	 * triangle. With a job system, different screen tiles run on
+	 * different threads and a triangle is set up once per tile it touches.
+	 * Returns the transformed vertices, in mesh order.
+	 */
+	template<typename Geometry, typename Visible>
+	inline const vector<vertex_out>& draw_fragments(const Geometry& mesh, Visible&& visible)
+	{
+		transform(shader, mesh, vout, jobs);
+
+		raster_all(mesh, vout, [&] (Rasterizer& r, size_t t)
+		{
+			const vertex_out* const v[3] = {
+				&vout[mesh.inds[3 * t]],
+				&vout[mesh.inds[3 * t + 1]],
+				&vout[mesh.inds[3 * t + 2]]
+			};
+
+			const vec4f p[3] = {v[0]->pos, v[1]->pos, v[2]->pos};
+
+			raster_triangle(r, p, visible(t, v));
+		});
+
+		return vout;
+	}
+
+	// Multisampled variant: shading runs once per pixel with any passing sample
+	template<typename Geometry, int N>
+	inline void draw(const Geometry& mesh, MSAATarget<N>& target)
+	{
+		using pattern = typename MSAATarget<N>::pattern;
+		using fragment = typename MSAATarget<N>::fragment;
+
+		transform(shader, mesh, vout);
+
+		for (size_t i = 0; i + 2 < mesh.inds.size(); i += 3) {
+			const vertex_out& v0 = vout[mesh.inds[i]];
+			const vertex_out& v1 = vout[mesh.inds[i + 1]];
+			const vertex_out& v2 = vout[mesh.inds[i + 2]];
+
+			const vec4f p[3] = {v0.pos, v1.pos, v2.pos};
+
+			rast.rasterize_msaa<pattern>(p, [&] (const fragment& o)
+			{
+				const unsigned pass = target.test(o);
+
+				if (!pass)
+					return;
+
+				target.write(o, pass, shader.fragment(
+					mix_varyings(v0.var, v1.var, v2.var, o.b, o.c)
+				));
+			});
+		}
+	}
+};
@@ -12,6 +12,9 @@ class Rasterizer
 {
 private:
 	float sx, sy, wover2, hover2;
+	
+	int vx0, vy0, vx1, vy1;
+	int cx0, cy0, cx1, cy1;
 
 	inline int x_s2p(const float& coord)
 	{
@@ -51,6 +54,22 @@ public:
 		
 		wover2 = w * 0.5f;
 		hover2 = h * 0.5f;
+		
+		vx0 = x;
+		vy0 = y;
+		vx1 = x + w - 1;
+		vy1 = y + h - 1;
+		
+		set_scissor(vx0, vy0, vx1, vy1);
+	}
+	
+	// Only pixels in [x0, x1] x [y0, y1] are produced; reset by set_view
+	inline void set_scissor(int x0, int y0, int x1, int y1)
+	{
+		cx0 = max(x0, vx0);
+		cy0 = max(y0, vy0);
+		cx1 = min(x1, vx1);
+		cy1 = min(y1, vy1);
 	}
 	
 	struct rastout {
@@ -58,12 +77,43 @@ public:
 		float depth, b, c;
 	};
 	
+	// Depth of the triangle's plane at pixel (x, y) is z0 + dzdx * x + dzdy * y
+	struct zplane {
+		float z0, dzdx, dzdy;
+		
+		inline float at(float x, float y) const
+		{
+			return z0 + dzdx * x + dzdy * y;
+		}
+	};
+	
+	enum blockmode {
+		block_reject,
+		block_accept,
+		block_test
+	};
+	
+	// Pixel with per-sample coverage; b and c are taken at the pixel center
+	template<int N>
+	struct msaaout {
+		int x, y;
+		unsigned mask;
+		float b, c;
+		float depth[N];
+	};
+	
 	inline vec<float, 3> vec4to3(const vec<float, 4> v)
 	{
 		return {v.x / v.w, v.y / v.w, v.z / v.w};
 	}
 	
-	inline void rasterize(vec4f vs[3], vector<rastout>& rout)
+	inline void rasterize(const vec4f vs[3], vector<rastout>& rout)
+	{
+		rasterize(vs, [&rout] (const rastout& o) { rout.push_back(o); });
+	}
+	
+	template<typename Emit>
+	inline void rasterize(const vec4f vs[3], Emit&& emit)
 	{
 		vec3f const v[3] = {vec4to3(vs[0]), 
 									vec4to3(vs[1]),
@@ -77,17 +127,20 @@ public:
 		
 		const float det = ax * by - bx * ay;
 		
+		if (det == 0.f)
+			return;
+		
 		auto const clamp = [] (float const x)
 		{
 			float const eps = 1e-6;
 			return 	x >= 1.f ? 1.f - eps : (x <= -1.f ? -1.f + eps : x);
 		};
 		
-		const int xmin = x_s2p(clamp(min(min(v[0].x, v[1].x), v[2].x)));
-        const int xmax = x_s2p(clamp(max(max(v[0].x, v[1].x), v[2].x)));
+		const int xmin = max(cx0, x_s2p(clamp(min(min(v[0].x, v[1].x), v[2].x))));
+        const int xmax = min(cx1, x_s2p(clamp(max(max(v[0].x, v[1].x), v[2].x))));
         
-        const int ymin = y_s2p(clamp(min(min(v[0].y, v[1].y), v[2].y)));
-        const int ymax = y_s2p(clamp(max(max(v[0].y, v[1].y), v[2].y)));
+        const int ymin = max(cy0, y_s2p(clamp(min(min(v[0].y, v[1].y), v[2].y))));
+        const int ymax = min(cy1, y_s2p(clamp(max(max(v[0].y, v[1].y), v[2].y))));
         
         for (int x = xmin; x <= xmax; ++x) {
 			const float cx = x_p2s(x) - v[0].x;
@@ -114,8 +167,301 @@ public:
 				
 				const float sum = a + b + c;
 				
-				rout.push_back({x, y, depth, b / sum, c / sum});
+				emit(rastout{x, y, depth, b / sum, c / sum});
 			}
 		}
 	}
+	
+	/*
+	 * Pattern::count samples at Pattern::offsets (in pixels, relative
+	 * to the pixel center) are tested against the triangle, every pixel
+	 * with at least one covered sample is emitted once.
+	 */
+	template<typename Pattern, typename Emit>
+	inline void rasterize_msaa(const vec4f vs[3], Emit&& emit)
+	{
+		constexpr int N = Pattern::count;
+		
+		vec3f const v[3] = {vec4to3(vs[0]), 
+									vec4to3(vs[1]),
+									vec4to3(vs[2])};
+		
+		const float ax = v[1].x - v[0].x;
+		const float ay = v[1].y - v[0].y;
+		
+		const float bx = v[2].x - v[0].x;
+		const float by = v[2].y - v[0].y;
+		
+		const float det = ax * by - bx * ay;
+		
+		if (det == 0.f)
+			return;
+		
+		float ox[N], oy[N];
+		for (int s = 0; s < N; ++s) {
+			ox[s] = Pattern::offsets[s][0] / wover2;
+			oy[s] = Pattern::offsets[s][1] / hover2;
+		}
+		
+		// samples reach half a pixel outside the center-based bounds
+		const int xmin = max(cx0, x_s2p(min(min(v[0].x, v[1].x), v[2].x)) - 1);
+		const int xmax = min(cx1, x_s2p(max(max(v[0].x, v[1].x), v[2].x)) + 1);
+		
+		const int ymin = max(cy0, y_s2p(min(min(v[0].y, v[1].y), v[2].y)) - 1);
+		const int ymax = min(cy1, y_s2p(max(max(v[0].y, v[1].y), v[2].y)) + 1);
+		
+		msaaout<N> o;
+		
+		for (int x = xmin; x <= xmax; ++x) {
+			const float cx = x_p2s(x) - v[0].x;
+			for (int y = ymin; y <= ymax; ++y) {
+				const float cy = y_p2s(y) - v[0].y;
+				
+				o.mask = 0;
+				
+				for (int s = 0; s < N; ++s) {
+					const float scx = cx + ox[s];
+					const float scy = cy + oy[s];
+					
+					const float b0 = (scx * by - scy * bx) / det;
+					const float c0 = (ax * scy - ay * scx) / det;
+					const float a0 = 1.f - b0 - c0;
+					
+					o.depth[s] = v[0].z * a0 + v[1].z * b0 + v[2].z * c0;
+					
+					if (a0 < 0 || b0 < 0 || c0 < 0)
+						continue;
+					
+					o.mask |= 1u << s;
+				}
+				
+				if (!o.mask)
+					continue;
+				
+				const float b0 = (cx * by - cy * bx) / det;
+				const float c0 = (ax * cy - ay * cx) / det;
+				const float a0 = 1.f - b0 - c0;
+				
+				const float a = a0 / vs[0].w;
+				const float b = b0 / vs[1].w;
+				const float c = c0 / vs[2].w;
+				
+				const float sum = a + b + c;
+				
+				o.x = x;
+				o.y = y;
+				o.b = b / sum;
+				o.c = c / sum;
+				
+				emit(static_cast<const msaaout<N>&>(o));
+			}
+		}
+	}
+	
+	/*
+	 * Edge functions in pixel steps, scaled by the sign of the area so
+	 * all three are >= 0 inside: e[i] + dx[i] * x + dy[i] * y at pixel
+	 * (x, y), and e[i] / area is the barycentric weight of vertex i.
+	 */
+	struct edges {
+		float e[3], dx[3], dy[3];
+		float area;
+		zplane plane;
+		int xmin, xmax, ymin, ymax;
+	};
+	
+	/*
+	 * False for triangles with no area. Kept out of line: inlined into
+	 * each caller, -ffast-math may round the plane differently per
+	 * instantiation, and then two draws of the same triangle disagree.
+	 */
+	[[gnu::noinline]] bool setup(const vec4f vs[3], edges& t)
+	{
+		vec3f const v[3] = {vec4to3(vs[0]),
+									vec4to3(vs[1]),
+									vec4to3(vs[2])};
+		
+		const float ax = v[1].x - v[0].x;
+		const float ay = v[1].y - v[0].y;
+		
+		const float bx = v[2].x - v[0].x;
+		const float by = v[2].y - v[0].y;
+		
+		const float det = ax * by - bx * ay;
+		
+		if (det == 0.f)
+			return false;
+		
+		auto const clamp = [] (float const x)
+		{
+			float const eps = 1e-6;
+			return 	x >= 1.f ? 1.f - eps : (x <= -1.f ? -1.f + eps : x);
+		};
+		
+		t.xmin = max(cx0, x_s2p(clamp(min(min(v[0].x, v[1].x), v[2].x))));
+		t.xmax = min(cx1, x_s2p(clamp(max(max(v[0].x, v[1].x), v[2].x))));
+		
+		t.ymin = max(cy0, y_s2p(clamp(min(min(v[0].y, v[1].y), v[2].y))));
+		t.ymax = min(cy1, y_s2p(clamp(max(max(v[0].y, v[1].y), v[2].y))));
+		
+		const float s = det > 0.f ? 1.f : -1.f;
+		
+		const float cx = x_p2s(0) - v[0].x;
+		const float cy = y_p2s(0) - v[0].y;
+		
+		t.area = det * s;
+		
+		t.e[1] = (cx * by - cy * bx) * s;
+		t.e[2] = (ax * cy - ay * cx) * s;
+		t.e[0] = t.area - t.e[1] - t.e[2];
+		
+		t.dx[1] = by * s / wover2;
+		t.dy[1] = -bx * s / hover2;
+		t.dx[2] = -ay * s / wover2;
+		t.dy[2] = ax * s / hover2;
+		t.dx[0] = -t.dx[1] - t.dx[2];
+		t.dy[0] = -t.dy[1] - t.dy[2];
+		
+		const float dz1 = v[1].z - v[0].z;
+		const float dz2 = v[2].z - v[0].z;
+		
+		t.plane.z0 = v[0].z + (t.e[1] * dz1 + t.e[2] * dz2) / t.area;
+		t.plane.dzdx = (by * dz1 - ay * dz2) / (det * wover2);
+		t.plane.dzdy = (ax * dz2 - bx * dz1) / (det * hover2);
+		
+		return true;
+	}
+	
+	/*
+	 * Walks the bounding box in B x B blocks aligned to the pixel grid.
+	 * For every block block_fn(x0, y0, full, plane) is asked first, where
+	 * full tells whether the triangle covers the whole block; rejected
+	 * blocks are skipped, and so are accepted ones unless Accepted is
+	 * set. Each column of a block solves the edge functions for its
+	 * covered rows y0..y1 and passes them to column(x, y0, y1, e, z),
+	 * with the edge values and plane depth at y0; both step by dy per row.
+	 */
+	template<int B, bool Accepted, typename BlockFn, typename Column>
+	inline void walk_blocks(const edges& t, BlockFn&& block_fn, Column&& column)
+	{
+		const auto inside = [&] (int x, int y)
+		{
+			for (int i = 0; i < 3; ++i)
+				if (t.e[i] + t.dx[i] * x + t.dy[i] * y < 0)
+					return false;
+			
+			return true;
+		};
+		
+		float rdy[3];
+		for (int i = 0; i < 3; ++i)
+			rdy[i] = t.dy[i] != 0.f ? 1.f / t.dy[i] : 0.f;
+		
+		for (int x0 = t.xmin - t.xmin % B; x0 <= t.xmax; x0 += B)
+			for (int y0 = t.ymin - t.ymin % B; y0 <= t.ymax; y0 += B) {
+				const int x1 = x0 + B - 1;
+				const int y1 = y0 + B - 1;
+				
+				// a block the bounds do not span can not be full
+				const bool full = x0 >= t.xmin && y0 >= t.ymin &&
+									x1 <= t.xmax && y1 <= t.ymax &&
+									inside(x0, y0) && inside(x1, y0) &&
+									inside(x0, y1) && inside(x1, y1);
+				
+				const blockmode mode = block_fn(x0, y0, full, t.plane);
+				
+				if (mode == block_reject || (!Accepted && mode == block_accept))
+					continue;
+				
+				const int yb = max(y0, t.ymin);
+				const int ye = min(y1, t.ymax);
+				
+				for (int x = max(x0, t.xmin); x <= min(x1, t.xmax); ++x) {
+					float e[3];
+					
+					// rows yb + k, k in [lo, hi], where every edge is >= 0
+					float lo = 0.f;
+					float hi = ye - yb;
+					
+					for (int i = 0; i < 3; ++i) {
+						e[i] = t.e[i] + t.dx[i] * x + t.dy[i] * yb;
+						
+						if (t.dy[i] > 0.f)
+							lo = max(lo, -e[i] * rdy[i]);
+						else if (t.dy[i] < 0.f)
+							hi = min(hi, -e[i] * rdy[i]);
+						else if (e[i] < 0.f)
+							hi = -1.f;
+					}
+					
+					if (lo > hi)
+						continue;
+					
+					const int k0 = static_cast<int>(ceilf(lo));
+					const int k1 = static_cast<int>(floorf(hi));
+					
+					for (int i = 0; i < 3; ++i)
+						e[i] += t.dy[i] * k0;
+					
+					column(x, yb + k0, yb + k1, static_cast<const float*>(e),
+							t.plane.at(x, yb + k0));
+				}
+			}
+	}
+	
+	/*
+	 * Blocks of walk_blocks; unless a block is rejected its covered pixels
+	 * are passed to emit as usual, with perspective-correct b and c.
+	 */
+	template<int B, typename BlockFn, typename Emit>
+	inline void rasterize_blocks(const vec4f vs[3], BlockFn&& block_fn, Emit&& emit)
+	{
+		edges t;
+		if (!setup(vs, t))
+			return;
+		
+		const float rarea = 1.f / t.area;
+		const float rw[3] = {1.f / vs[0].w, 1.f / vs[1].w, 1.f / vs[2].w};
+		
+		walk_blocks<B, true>(t, block_fn,
+		[&] (int x, int y0, int y1, const float* e0, float z)
+		{
+			float e[3] = {e0[0], e0[1], e0[2]};
+			
+			for (int y = y0; y <= y1; ++y) {
+				const float a = e[0] * rarea * rw[0];
+				const float b = e[1] * rarea * rw[1];
+				const float c = e[2] * rarea * rw[2];
+				
+				const float rsum = 1.f / (a + b + c);
+				
+				emit(rastout{x, y, z, b * rsum, c * rsum});
+				
+				for (int i = 0; i < 3; ++i)
+					e[i] += t.dy[i];
+				
+				z += t.plane.dzdy;
+			}
+		});
+	}
+	
+	/*
+	 * Depth only: the same blocks, coverage and plane depth as
+	 * rasterize_blocks, but whole columns go to emit(x, y0, y1, z, dzdy),
+	 * z at y0 and stepped by dzdy per row. Accepted blocks are not
+	 * walked at all, block_fn has stored them.
+	 */
+	template<int B, typename BlockFn, typename Emit>
+	inline void rasterize_depth(const vec4f vs[3], BlockFn&& block_fn, Emit&& emit)
+	{
+		edges t;
+		if (!setup(vs, t))
+			return;
+		
+		walk_blocks<B, false>(t, block_fn,
+		[&] (int x, int y0, int y1, const float*, float z)
+		{
+			emit(x, y0, y1, z, t.plane.dzdy);
+		});
+	}
 };
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <algorithm>
+
+#include "linalg.hpp"
+#include "wfobj.hpp"
+
+// Shared camera uniforms and the clip-space projection used by all shaders
+struct Camera
+{
+	sqmat3f rotater;
+	vec3f campos;
+	vec3f move;
+	
+	float ratio;
+	float c1, c2;
+	
+	inline void set_projection(float aspect, float near, float far)
+	{
+		ratio = aspect;
+		c1 = (far + near) / (far - near);
+		c2 = 2.f * near * far / (far - near);
+	}
+	
+	inline vec4f project(const vec3f& pos) const
+	{
+		const vec3f r = rotater * (pos + move - campos);
+		
+		return {-r.x / ratio, -r.y, c1 * r.z + c2, r.z};
+	}
+	
+	// World position of a clip-space point; rotater is orthonormal
+	inline vec3f unproject(const vec4f& clip) const
+	{
+		const vec3f r = {-clip.x * ratio, -clip.y, clip.w};
+		
+		vec3f world;
+		for (int i = 0; i < 3; ++i)
+			world[i] = rotater[0][i] * r.x + rotater[1][i] * r.y + rotater[2][i] * r.z;
+		
+		return world + campos - move;
+	}
+};
+
+inline bgracolor_t to_bgra(const vec3f& color)
+{
+	return {
+		static_cast<uint8_t>(color.x * 255u),
+		static_cast<uint8_t>(color.y * 255u),
+		static_cast<uint8_t>(color.z * 255u),
+		255u
+	};
+}
+
+// Directional Lambert lighting, interpolates the view-space normal only
+struct LambertShader
+{
+	struct varyings {
+		vec3f norm;
+	};
+	
+	Camera cam;
+	vec3f light;
+	vec3f color;
+	
+	inline vec4f vertex(const Mesh::vertex& in, varyings& out) const
+	{
+		out.norm = cam.rotater * in.norm;
+		return cam.project(in.pos);
+	}
+	
+	inline bgracolor_t fragment(const varyings& in) const
+	{
+		const float nlight = std::max(0.f, light * in.norm);
+		
+		return to_bgra(color * nlight);
+	}
+};
+
+// Same lighting in world space, so the light does not turn with the camera
+struct WorldLambertShader
+{
+	// shading ignores the camera; TemporalCache relies on it
+	static constexpr bool world_space = true;
+	
+	struct varyings {
+		vec3f norm;
+	};
+	
+	Camera cam;
+	vec3f light;
+	vec3f color;
+	
+	inline vec4f vertex(const Mesh::vertex& in, varyings& out) const
+	{
+		out.norm = in.norm;
+		return cam.project(in.pos);
+	}
+	
+	inline bgracolor_t fragment(const varyings& in) const
+	{
+		const float nlight = std::max(0.f, light * in.norm);
+		
+		return to_bgra(color * nlight);
+	}
+};
+
+// Constant color, nothing is interpolated
+struct FlatShader
+{
+	static constexpr bool world_space = true;
+	
+	struct varyings {};
+	
+	Camera cam;
+	vec3f color;
+	
+	inline vec4f vertex(const Mesh::vertex& in, varyings&) const
+	{
+		return cam.project(in.pos);
+	}
+	
+	inline bgracolor_t fragment(const varyings&) const
+	{
+		return to_bgra(color);
+	}
+};
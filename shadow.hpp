@@ -0,0 +1,266 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "pipeline.hpp"
+#include "shaders.hpp"
+
+using namespace std;
+
+struct ShadowOptions
+{
+	// the map is size x size texels
+	int size = 1024;
+
+	// PCF takes (2 * radius + 1)^2 taps around the texel
+	int pcf_radius = 1;
+
+	// constant depth bias in NDC, a slope term is added per fragment
+	float bias = 0.002f;
+};
+
+// Orthographic view along a directional light, fitted to a bounding sphere
+struct LightView
+{
+	sqmat3f rotater;
+	vec3f center;
+	float scale;
+
+	// light points towards the light, as in the shaders
+	inline void fit(const vec3f& light, const vec3f& c, float radius)
+	{
+		const vec3f dir = light.normalized();
+		const vec3f up = fabsf(dir.y) < 0.9f ? vec3f{0.f, 1.f, 0.f} : vec3f{1.f, 0.f, 0.f};
+
+		rotater = rotate(dir, up);
+		center = c;
+		scale = 1.f / radius;
+	}
+
+	// Nearer to the light is smaller depth; w is 1, nothing is divided
+	inline vec4f project(const vec3f& pos) const
+	{
+		const vec3f r = rotater * (pos - center);
+
+		return {r.x * scale, r.y * scale, -r.z * scale, 1.f};
+	}
+};
+
+// Positions only, for the depth-only pass from the light
+struct LightShader
+{
+	struct varyings {};
+
+	LightView view;
+
+	inline vec4f vertex(const Mesh::vertex& in, varyings&) const
+	{
+		return view.project(in.pos);
+	}
+
+	inline bgracolor_t fragment(const varyings&) const
+	{
+		return {};
+	}
+};
+
+/*
+ * Depth from the light, rendered with Pipeline::draw_depth only when the
+ * light or the geometry changed, then resolved into a flat texture with
+ * a lit border of 2 * pcf_radius texels, so a PCF tap is one load.
+ */
+class ShadowMap
+{
+private:
+	ShadowOptions opts;
+	Pipeline<LightShader> pipe;
+	JobSystem* jobs;
+
+	// (size + 4 * radius)^2 texels, the map starts at (2 * radius, 2 * radius)
+	vector<float> texels;
+	int border;
+	int stride;
+
+	float half;
+	float texel;
+
+	bool stale;
+
+	inline void resolve()
+	{
+		const DepthBuffer<>& d = pipe.depth_buffer();
+
+		auto const rows = [&] (size_t first, size_t last)
+		{
+			for (size_t y = first; y < last; ++y) {
+				float* row = &texels[(y + border) * stride + border];
+
+				for (int x = 0; x < opts.size; ++x)
+					row[x] = d.read(x, y);
+			}
+		};
+
+		if (jobs)
+			jobs->parallel_for(0, opts.size, 64, rows);
+		else
+			rows(0, opts.size);
+	}
+
+public:
+	ShadowMap(const ShadowOptions& options = ShadowOptions()) :
+		opts(options), jobs(nullptr), border(2 * options.pcf_radius),
+		stride(options.size + 2 * border), half(0.5f * options.size),
+		texel(2.f / options.size), stale(true)
+	{
+		pipe.set_view(opts.size, opts.size);
+
+		// taps off the map see the light
+		texels.assign(static_cast<size_t>(stride) * stride, numeric_limits<float>::infinity());
+	}
+
+	inline void set_jobs(JobSystem* js)
+	{
+		jobs = js;
+		pipe.set_jobs(js);
+	}
+
+	inline void fit(const vec3f& light, const vec3f& center, float radius)
+	{
+		pipe.shader.view.fit(light, center, radius);
+		stale = true;
+	}
+
+	// The geometry moved; the next update() renders again
+	inline void invalidate()
+	{
+		stale = true;
+	}
+
+	inline const LightView& view() const
+	{
+		return pipe.shader.view;
+	}
+
+	template<typename Geometry>
+	inline void render(const Geometry& mesh)
+	{
+		pipe.clear();
+		pipe.draw_depth(mesh);
+		resolve();
+
+		stale = false;
+	}
+
+	// Renders only after fit() or invalidate(); true if it did
+	template<typename Geometry>
+	inline bool update(const Geometry& mesh)
+	{
+		if (!stale)
+			return false;
+
+		render(mesh);
+		return true;
+	}
+
+	inline const DepthBuffer<>& depth() const
+	{
+		return pipe.depth_buffer();
+	}
+
+	/*
+	 * Share of the PCF taps around p, a point in light NDC, that see the
+	 * light. nl is the cosine to the light; steep surfaces change depth
+	 * faster across a texel and get more bias. Outside the map is lit.
+	 */
+	inline float lit(const vec3f& p, float nl) const
+	{
+		const int r = opts.pcf_radius;
+
+		const float slope = min(sqrtf(max(1.f - nl * nl, 0.f)) / max(nl, 1e-3f), 8.f);
+		const float z = p.z - opts.bias - (r + 1) * texel * slope;
+
+		const int cx = lroundf((p.x + 1.f) * half - 0.5f);
+		const int cy = lroundf((p.y + 1.f) * half - 0.5f);
+
+		// every tap is off the map and in the border, or beyond it
+		if (cx < -r || cy < -r || cx >= opts.size + r || cy >= opts.size + r)
+			return 1.f;
+
+		const float* t = &texels[(cy + border) * stride + cx + border];
+
+		const bool center = z <= t[0];
+
+		if (r == 0)
+			return center;
+
+		// away from shadow edges the centre and corners agree and the rest is skipped
+		const int up = r * stride;
+		const int corners = (z <= t[-up - r]) + (z <= t[-up + r])
+							+ (z <= t[up - r]) + (z <= t[up + r]);
+
+		if (corners == 4 * center)
+			return center;
+
+		int seen = 0;
+
+		for (int y = -r; y <= r; ++y)
+			for (int x = -r; x <= r; ++x)
+				seen += z <= t[y * stride + x];
+
+		return static_cast<float>(seen) / ((2 * r + 1) * (2 * r + 1));
+	}
+
+	inline size_t memory_usage() const
+	{
+		return pipe.memory_usage() + texels.capacity() * sizeof(float);
+	}
+};
+
+/*
+ * Lambert with shadows. Unlike LambertShader, light and normals are in
+ * world space, since the shadow map does not move with the camera.
+ */
+struct ShadowShader
+{
+	static constexpr bool world_space = true;
+
+	struct varyings {
+		vec3f norm;
+		vec3f shadow;
+	};
+
+	Camera cam;
+	vec3f light;
+	vec3f color;
+
+	// must be set before drawing
+	const ShadowMap* shadows = nullptr;
+
+	inline vec4f vertex(const Mesh::vertex& in, varyings& out) const
+	{
+		assert(shadows);
+
+		const vec4f s = shadows->view().project(in.pos);
+
+		out.norm = in.norm;
+		out.shadow = {s.x, s.y, s.z};
+
+		return cam.project(in.pos);
+	}
+
+	inline bgracolor_t fragment(const varyings& in) const
+	{
+		const float nlight = max(0.f, light * in.norm);
+
+		if (nlight == 0.f)
+			return {0, 0, 0, 255};
+
+		assert(shadows);
+
+		return to_bgra(color * (nlight * shadows->lit(in.shadow, nlight)));
+	}
+};
@@ -0,0 +1,593 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+
+extern "C"
+{
+	#include <sys/socket.h>
+	#include <sys/un.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <arpa/inet.h>
+	#include <netdb.h>
+	#include <unistd.h>
+	#include <fcntl.h>
+}
+
+#include "linalg.hpp"
+
+using namespace std;
+
+/*
+ * Wire format, native byte order: a stream_header, then for every changed
+ * tile a tile_header and its pixels, bgra in row order within the tile,
+ * RLE coded. The first frame to a client has every tile.
+ */
+struct stream_header
+{
+	static constexpr uint32_t signature = 0x46545352;	// "RSTF"
+
+	uint32_t magic;
+	uint32_t frame;
+	uint16_t width, height;
+	uint16_t tile, reserved;
+	uint32_t tiles;
+	uint32_t bytes;		// everything after this header
+};
+
+struct tile_header
+{
+	uint16_t tx, ty;
+	uint32_t bytes;
+};
+
+/*
+ * Run-length coding on whole pixels. A control byte c < 128 is followed by
+ * c + 1 literal pixels, c >= 128 by one pixel repeated c - 126 times.
+ */
+inline size_t rle_bound(size_t count)
+{
+	return count * sizeof(uint32_t) + (count + 127) / 128;
+}
+
+inline size_t rle_encode(const uint32_t* px, size_t count, uint8_t* out)
+{
+	uint8_t* const begin = out;
+
+	size_t i = 0;
+
+	while (i < count) {
+		size_t run = 1;
+		while (i + run < count && run < 129 && px[i + run] == px[i])
+			++run;
+
+		if (run >= 2) {
+			*out++ = static_cast<uint8_t>(run + 126);
+			memcpy(out, px + i, sizeof(uint32_t));
+			out += sizeof(uint32_t);
+			i += run;
+			continue;
+		}
+
+		// literals up to the next pair of equal pixels
+		size_t j = i + 1;
+		while (j < count && j - i < 128 && !(j + 1 < count && px[j] == px[j + 1]))
+			++j;
+
+		*out++ = static_cast<uint8_t>(j - i - 1);
+		memcpy(out, px + i, (j - i) * sizeof(uint32_t));
+		out += (j - i) * sizeof(uint32_t);
+		i = j;
+	}
+
+	return out - begin;
+}
+
+// False if the data does not decode to exactly count pixels
+inline bool rle_decode(const uint8_t* in, size_t size, uint32_t* px, size_t count)
+{
+	const uint8_t* const end = in + size;
+
+	size_t i = 0;
+
+	while (in < end) {
+		const unsigned c = *in++;
+
+		if (c < 128) {
+			const size_t n = c + 1;
+			if (i + n > count || static_cast<size_t>(end - in) < n * sizeof(uint32_t))
+				return false;
+
+			memcpy(px + i, in, n * sizeof(uint32_t));
+			in += n * sizeof(uint32_t);
+			i += n;
+		}
+		else {
+			const size_t n = c - 126;
+			if (i + n > count || static_cast<size_t>(end - in) < sizeof(uint32_t))
+				return false;
+
+			uint32_t p;
+			memcpy(&p, in, sizeof(p));
+			in += sizeof(p);
+
+			fill(px + i, px + i + n, p);
+			i += n;
+		}
+	}
+
+	return i == count;
+}
+
+/*
+ * Diffs frames against the previous one tile by tile and codes the
+ * changed tiles into one message. Buffers are sized for the worst case
+ * up front, so encoding does not allocate.
+ */
+class TileEncoder
+{
+private:
+	int w, h, tile;
+	int tx, ty;
+
+	vector<uint32_t> prev;
+	vector<uint32_t> scratch;
+	bool keyframe;
+
+public:
+	TileEncoder(int width, int height, int tilesize = 32) :
+		w(width), h(height), tile(tilesize),
+		tx((width + tilesize - 1) / tilesize), ty((height + tilesize - 1) / tilesize),
+		prev(static_cast<size_t>(width) * height), scratch(tilesize * tilesize),
+		keyframe(true)
+	{
+	}
+
+	inline size_t max_message() const
+	{
+		return sizeof(stream_header)
+			+ static_cast<size_t>(tx) * ty * (sizeof(tile_header) + rle_bound(tile * tile));
+	}
+
+	// The next frame is sent whole, as to a new client
+	inline void reset()
+	{
+		keyframe = true;
+	}
+
+	// Writes the message into out, which must hold max_message() bytes
+	inline size_t encode(const bgracolor_t* pixels, uint32_t frame, uint8_t* out,
+							uint32_t& tiles)
+	{
+		const uint32_t* px = reinterpret_cast<const uint32_t*>(pixels);
+
+		uint8_t* p = out + sizeof(stream_header);
+		tiles = 0;
+
+		for (int j = 0; j < ty; ++j)
+			for (int i = 0; i < tx; ++i) {
+				const int x0 = i * tile;
+				const int y0 = j * tile;
+				const int cw = min(tile, w - x0);
+				const int ch = min(tile, h - y0);
+
+				bool changed = keyframe;
+
+				for (int y = y0; y < y0 + ch && !changed; ++y)
+					changed = memcmp(px + y * w + x0, prev.data() + y * w + x0,
+										cw * sizeof(uint32_t)) != 0;
+
+				if (!changed)
+					continue;
+
+				for (int y = 0; y < ch; ++y) {
+					const size_t row = static_cast<size_t>(y0 + y) * w + x0;
+
+					memcpy(scratch.data() + y * cw, px + row, cw * sizeof(uint32_t));
+					memcpy(prev.data() + row, px + row, cw * sizeof(uint32_t));
+				}
+
+				tile_header th = {static_cast<uint16_t>(i), static_cast<uint16_t>(j), 0};
+				th.bytes = rle_encode(scratch.data(), cw * ch, p + sizeof(th));
+
+				memcpy(p, &th, sizeof(th));
+				p += sizeof(th) + th.bytes;
+
+				++tiles;
+			}
+
+		keyframe = false;
+
+		const stream_header hdr = {
+			stream_header::signature, frame,
+			static_cast<uint16_t>(w), static_cast<uint16_t>(h),
+			static_cast<uint16_t>(tile), 0,
+			tiles, static_cast<uint32_t>(p - out - sizeof(stream_header))
+		};
+
+		memcpy(out, &hdr, sizeof(hdr));
+
+		return p - out;
+	}
+};
+
+// Applies messages to its own copy of the frame
+class TileDecoder
+{
+private:
+	int w, h;
+	vector<bgracolor_t> pixels;
+	vector<uint8_t> payload;
+	vector<uint32_t> scratch;
+
+public:
+	TileDecoder() : w(0), h(0)
+	{
+	}
+
+	inline int width() const { return w; }
+	inline int height() const { return h; }
+	inline const bgracolor_t* data() const { return pixels.data(); }
+
+	inline bool decode(const stream_header& hdr, const uint8_t* in)
+	{
+		if (hdr.magic != stream_header::signature || !hdr.tile)
+			return false;
+
+		if (hdr.width != w || hdr.height != h) {
+			w = hdr.width;
+			h = hdr.height;
+			pixels.assign(static_cast<size_t>(w) * h, bgracolor_t{0, 0, 0, 255});
+		}
+
+		scratch.resize(hdr.tile * hdr.tile);
+
+		const uint8_t* const end = in + hdr.bytes;
+		uint32_t* px = reinterpret_cast<uint32_t*>(pixels.data());
+
+		for (uint32_t t = 0; t < hdr.tiles; ++t) {
+			tile_header th;
+			if (static_cast<size_t>(end - in) < sizeof(th))
+				return false;
+
+			memcpy(&th, in, sizeof(th));
+			in += sizeof(th);
+
+			const int x0 = th.tx * hdr.tile;
+			const int y0 = th.ty * hdr.tile;
+
+			if (x0 >= w || y0 >= h || static_cast<size_t>(end - in) < th.bytes)
+				return false;
+
+			const int cw = min<int>(hdr.tile, w - x0);
+			const int ch = min<int>(hdr.tile, h - y0);
+
+			if (!rle_decode(in, th.bytes, scratch.data(), cw * ch))
+				return false;
+
+			in += th.bytes;
+
+			for (int y = 0; y < ch; ++y)
+				memcpy(px + static_cast<size_t>(y0 + y) * w + x0, scratch.data() + y * cw,
+						cw * sizeof(uint32_t));
+		}
+
+		return in == end;
+	}
+
+	// Blocks for the next message; false on a closed or broken stream
+	inline bool read(int fd, stream_header& hdr);
+};
+
+inline bool send_all(int fd, const void* data, size_t size)
+{
+	const char* p = static_cast<const char*>(data);
+
+	while (size) {
+		const ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+inline bool recv_all(int fd, void* data, size_t size)
+{
+	char* p = static_cast<char*>(data);
+
+	while (size) {
+		const ssize_t n = recv(fd, p, size, 0);
+		if (n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+inline bool TileDecoder::read(int fd, stream_header& hdr)
+{
+	if (!recv_all(fd, &hdr, sizeof(hdr)) || hdr.magic != stream_header::signature)
+		return false;
+
+	payload.resize(hdr.bytes);
+
+	return recv_all(fd, payload.data(), payload.size()) && decode(hdr, payload.data());
+}
+
+/*
+ * Addresses are unix:PATH or tcp:PORT to listen on every interface,
+ * tcp:HOST:PORT to connect.
+ */
+inline int stream_listen(const string& address)
+{
+	int fd = -1;
+
+	if (address.compare(0, 5, "unix:") == 0) {
+		sockaddr_un sa = {};
+		sa.sun_family = AF_UNIX;
+		strncpy(sa.sun_path, address.c_str() + 5, sizeof(sa.sun_path) - 1);
+
+		unlink(sa.sun_path);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0) {
+			if (fd >= 0)
+				close(fd);
+			throw runtime_error("can not listen on " + address);
+		}
+	}
+	else if (address.compare(0, 4, "tcp:") == 0) {
+		sockaddr_in sa = {};
+		sa.sin_family = AF_INET;
+		sa.sin_addr.s_addr = htonl(INADDR_ANY);
+		sa.sin_port = htons(atoi(address.c_str() + 4));
+
+		const int yes = 1;
+
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd >= 0)
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+		if (fd < 0 || bind(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) < 0) {
+			if (fd >= 0)
+				close(fd);
+			throw runtime_error("can not listen on " + address);
+		}
+	}
+	else
+		throw invalid_argument("stream address must be unix:PATH or tcp:PORT");
+
+	if (listen(fd, 1) < 0) {
+		close(fd);
+		throw runtime_error("can not listen on " + address);
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	return fd;
+}
+
+inline int stream_connect(const string& address)
+{
+	int fd = -1;
+
+	if (address.compare(0, 5, "unix:") == 0) {
+		sockaddr_un sa = {};
+		sa.sun_family = AF_UNIX;
+		strncpy(sa.sun_path, address.c_str() + 5, sizeof(sa.sun_path) - 1);
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&sa), sizeof(sa)) == 0)
+			return fd;
+	}
+	else if (address.compare(0, 4, "tcp:") == 0) {
+		const string rest = address.substr(4);
+		const size_t colon = rest.rfind(':');
+
+		const string host = colon == string::npos ? "127.0.0.1" : rest.substr(0, colon);
+		const string port = colon == string::npos ? rest : rest.substr(colon + 1);
+
+		addrinfo hints = {};
+		hints.ai_family = AF_INET;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* found = nullptr;
+
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) == 0) {
+			fd = socket(AF_INET, SOCK_STREAM, 0);
+
+			const bool ok = fd >= 0 && connect(fd, found->ai_addr, found->ai_addrlen) == 0;
+			freeaddrinfo(found);
+
+			if (ok)
+				return fd;
+		}
+	}
+	else
+		throw invalid_argument("stream address must be unix:PATH or tcp:[HOST:]PORT");
+
+	if (fd >= 0)
+		close(fd);
+
+	throw runtime_error("can not connect to " + address);
+}
+
+/*
+ * Streams frames to one client at a time. submit() only copies the frame
+ * into a mailbox; diffing, coding and sending happen on the encoder
+ * thread. A frame still waiting when the next one arrives is replaced
+ * and counted as dropped, so a slow link never stalls rendering.
+ */
+class StreamServer
+{
+public:
+	struct stats {
+		unsigned submitted;
+		unsigned sent;
+		unsigned dropped;
+		unsigned idle;		// no client connected
+		size_t bytes;
+		size_t tiles;
+		double encode;		// seconds spent diffing and coding
+	};
+
+private:
+	int w, h;
+	int listener;
+	int client;
+
+	TileEncoder encoder;
+	vector<uint8_t> message;
+
+	vector<bgracolor_t> pending, working;
+	bool has_pending;
+	bool stopping;
+	uint32_t frame;
+
+	stats counters;
+
+	mutex lock;
+	condition_variable wake;
+	thread worker;
+
+	inline void accept_client()
+	{
+		client = accept(listener, nullptr, nullptr);
+		if (client < 0)
+			return;
+
+		const int yes = 1;
+		setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+		encoder.reset();
+	}
+
+	inline void run()
+	{
+		using clock = chrono::steady_clock;
+
+		unique_lock<mutex> guard(lock);
+
+		while (true) {
+			wake.wait(guard, [this] { return has_pending || stopping; });
+
+			if (stopping)
+				return;
+
+			swap(pending, working);
+			has_pending = false;
+
+			const uint32_t number = frame;
+
+			guard.unlock();
+
+			if (client < 0)
+				accept_client();
+
+			bool sent = false;
+			uint32_t tiles = 0;
+			size_t size = 0;
+			double seconds = 0.;
+
+			if (client >= 0) {
+				const clock::time_point start = clock::now();
+				size = encoder.encode(working.data(), number, message.data(), tiles);
+				seconds = chrono::duration<double>(clock::now() - start).count();
+
+				sent = send_all(client, message.data(), size);
+
+				if (!sent) {
+					close(client);
+					client = -1;
+				}
+			}
+
+			guard.lock();
+
+			if (sent) {
+				++counters.sent;
+				counters.bytes += size;
+				counters.tiles += tiles;
+				counters.encode += seconds;
+			}
+			else
+				++counters.idle;
+		}
+	}
+
+public:
+	StreamServer(const string& address, int width, int height, int tilesize = 32) :
+		w(width), h(height), listener(stream_listen(address)), client(-1),
+		encoder(width, height, tilesize),
+		pending(static_cast<size_t>(width) * height), working(pending.size()),
+		has_pending(false), stopping(false), frame(0), counters{}
+	{
+		message.resize(encoder.max_message());
+		worker = thread([this] { run(); });
+	}
+
+	StreamServer(const StreamServer&) = delete;
+
+	~StreamServer()
+	{
+		{
+			lock_guard<mutex> guard(lock);
+			stopping = true;
+		}
+
+		wake.notify_one();
+		worker.join();
+
+		if (client >= 0)
+			close(client);
+		close(listener);
+	}
+
+	// Rows top first, as in Framebuffer::data() and XWindow::data()
+	inline void submit(const bgracolor_t* pixels)
+	{
+		{
+			lock_guard<mutex> guard(lock);
+
+			if (has_pending)
+				++counters.dropped;
+
+			memcpy(pending.data(), pixels, pending.size() * sizeof(bgracolor_t));
+			has_pending = true;
+
+			++counters.submitted;
+			++frame;
+		}
+
+		wake.notify_one();
+	}
+
+	inline stats get_stats()
+	{
+		lock_guard<mutex> guard(lock);
+		return counters;
+	}
+
+	inline void reset_stats()
+	{
+		lock_guard<mutex> guard(lock);
+		counters = {};
+	}
+};
@@ -0,0 +1,354 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
+
+#include "pipeline.hpp"
+#include "shaders.hpp"
+
+using namespace std;
+
+struct TemporalOptions
+{
+	// every frame one in this many pixels is reshaded whatever its age,
+	// rounded up to a power of two
+	unsigned refresh_period = 8;
+
+	// frames a color may be carried along before it must be reshaded
+	unsigned max_age = 16;
+
+	// relative view depth difference still taken as the same surface
+	float depth_tolerance = 0.01f;
+};
+
+// Shader::world_space says shading ignores the camera, so colors can move with it
+template<typename Shader, typename = void>
+struct shades_in_world_space : false_type {};
+
+template<typename Shader>
+struct shades_in_world_space<Shader, void_t<decltype(Shader::world_space)>> :
+	integral_constant<bool, Shader::world_space> {};
+
+/*
+ * Reuses last frame's shading. Reprojection is folded into the raster
+ * pass: every triangle's vertices are mapped into the previous frame
+ * once, so a fragment finds its old position from its barycentrics and
+ * looks it up there. If the depth there matches, its color is taken
+ * over; otherwise the pixel was disoccluded and the fragment's triangle
+ * and barycentrics are kept, to be shaded after the raster pass in one
+ * tight loop, overdrawn fragments skipped. Reused colors age, and a
+ * staggered share of the pixels is reshaded every frame, so resampling
+ * errors do not build up.
+ *
+ * A reused pixel still costs its lookup, so this pays off when shading
+ * costs more than that: on the bench's procedural marble the cached
+ * frame is faster, on plain Lambert it is slower.
+ *
+ * Only shaders that compute in world space qualify, with a Camera named
+ * cam and world_space set: a color that depends on the view would be
+ * wrong as soon as the camera turns. Call invalidate() when anything but
+ * the camera changes: uniforms, the mesh, the view size.
+ */
+template<typename Shader, DepthFormat F = DepthFormat::float32>
+class TemporalCache
+{
+	static_assert(shades_in_world_space<Shader>::value,
+					"TemporalCache needs a shader with world_space shading");
+
+public:
+	using pipeline = Pipeline<Shader, F>;
+	using vertex_out = typename pipeline::vertex_out;
+
+	// the depth buffer's tiles, so coverage comes from its tile states
+	static constexpr int tilesize = DepthBuffer<F>::tilesize;
+
+	struct stats {
+		size_t covered;
+		size_t reused;
+		size_t disoccluded;
+		size_t refreshed;
+
+		inline size_t shaded() const
+		{
+			return disoccluded + refreshed;
+		}
+
+		inline double hit_rate() const
+		{
+			return covered ? static_cast<double>(reused) / covered : 0.;
+		}
+
+		inline stats& operator+=(const stats& o)
+		{
+			covered += o.covered;
+			reused += o.reused;
+			disoccluded += o.disoccluded;
+			refreshed += o.refreshed;
+			return *this;
+		}
+	};
+
+private:
+	// One pixel of a frame: the pixels of a tile lie together, as in the
+	// depth buffer. depth is view w, 0 where nothing was drawn. The alpha
+	// of color holds the age, 0 for a color shaded this frame, plus
+	// refreshed_bit if that was a refresh.
+	struct texel {
+		float depth;
+		bgracolor_t color;
+	};
+
+	static constexpr uint8_t refreshed_bit = 0x80;
+	static constexpr uint8_t age_bits = 0x7f;
+
+	// Fragment left to shade: its triangle and barycentrics
+	struct source {
+		uint32_t tri;
+		float b, c;
+	};
+
+	// Rows of previous x, y and w over current (x, y, w, 1) in clip space
+	struct reprojection {
+		vec4f x, y, w;
+	};
+
+	TemporalOptions opts;
+
+	int w, h, tw, th;
+
+	// current and previous frame, only tiles covered in it hold anything
+	vector<texel> texels[2];
+	vector<uint8_t> covered[2];
+	int cur;
+
+	// current frame only, valid where the texel is not reused
+	vector<source> sources;
+
+	Camera prev_cam;
+	bool valid;
+	unsigned frame;
+
+	stats totals;
+
+	// Camera::unproject with cam, then Camera::project with prev, as one matrix
+	static inline reprojection between(const Camera& cam, const Camera& prev)
+	{
+		// K = prev.rotater * transpose(cam.rotater)
+		float k[3][3];
+		for (int i = 0; i < 3; ++i)
+			for (int j = 0; j < 3; ++j)
+				k[i][j] = prev.rotater[i][0] * cam.rotater[j][0]
+						+ prev.rotater[i][1] * cam.rotater[j][1]
+						+ prev.rotater[i][2] * cam.rotater[j][2];
+
+		const vec3f t = prev.rotater * (cam.campos - cam.move + prev.move - prev.campos);
+
+		vec4f q[3];
+		for (int i = 0; i < 3; ++i)
+			q[i] = {-k[i][0] * cam.ratio, -k[i][1], k[i][2], t[i]};
+
+		return {q[0] * (-1.f / prev.ratio), q[1] * -1.f, q[2]};
+	}
+
+	static inline float apply(const vec4f& row, const vec4f& clip)
+	{
+		return row.x * clip.x + row.y * clip.y + row.z * clip.w + row.w;
+	}
+
+	inline size_t offset(int x, int y) const
+	{
+		const size_t t = (y / tilesize) * tw + x / tilesize;
+
+		return t * tilesize * tilesize + (y % tilesize) * tilesize + x % tilesize;
+	}
+
+public:
+	TemporalCache(const TemporalOptions& options = TemporalOptions()) :
+		opts(options), w(0), h(0), tw(0), th(0), cur(0), valid(false), frame(0), totals{}
+	{
+		unsigned period = 1;
+		while (period < opts.refresh_period)
+			period *= 2;
+
+		opts.refresh_period = period;
+		opts.max_age = min(max(opts.max_age, 1u), static_cast<unsigned>(age_bits));
+	}
+
+	inline void resize(int width, int height)
+	{
+		w = width;
+		h = height;
+
+		tw = (w + tilesize - 1) / tilesize;
+		th = (h + tilesize - 1) / tilesize;
+
+		for (int k = 0; k < 2; ++k) {
+			texels[k].assign(tw * th * tilesize * tilesize, texel{0.f, {0, 0, 0, 0}});
+			covered[k].assign(tw * th, 0);
+		}
+
+		sources.resize(tw * th * tilesize * tilesize);
+
+		valid = false;
+	}
+
+	inline void invalidate()
+	{
+		valid = false;
+	}
+
+	inline const stats& total() const
+	{
+		return totals;
+	}
+
+	inline void reset_total()
+	{
+		totals = {};
+	}
+
+	inline size_t memory_usage() const
+	{
+		return 2 * texels[0].capacity() * sizeof(texel)
+			+ 2 * covered[0].capacity() * sizeof(uint8_t)
+			+ sources.capacity() * sizeof(source);
+	}
+
+	// pipe must be set to the same view size; target is not cleared here
+	template<typename Geometry, typename Target>
+	inline stats draw(pipeline& pipe, const Geometry& mesh, Target& target)
+	{
+		const int prev = cur;
+		cur ^= 1;
+
+		// what is left from two frames ago lies in the tiles covered then
+		for (int t = 0; t < tw * th; ++t)
+			if (covered[cur][t])
+				fill_n(&texels[cur][t * tilesize * tilesize], tilesize * tilesize,
+						texel{0.f, {0, 0, 0, 0}});
+
+		const Shader& shader = pipe.shader;
+		const reprojection back = between(shader.cam, prev_cam);
+
+		const unsigned mask = opts.refresh_period - 1;
+
+		const float hw = 0.5f * w;
+		const float hh = 0.5f * h;
+
+		const vector<vertex_out>& vout = pipe.draw_fragments(mesh,
+			[&] (size_t t, const vertex_out* const v[3])
+		{
+			// previous x, y and w, then current w, at a vertex: linear in
+			// the perspective-correct barycentrics like any varying
+			vec4f q[3];
+			for (int k = 0; k < 3; ++k)
+				q[k] = {apply(back.x, v[k]->pos), apply(back.y, v[k]->pos),
+						apply(back.w, v[k]->pos), v[k]->pos.w};
+
+			const vec4f qb = q[1] - q[0];
+			const vec4f qc = q[2] - q[0];
+
+			return [&, q0 = q[0], qb, qc, tri = static_cast<uint32_t>(t)]
+				(const Rasterizer::rastout& o)
+			{
+				const size_t i = offset(o.x, o.y);
+				const vec4f p = q0 + qb * o.b + qc * o.c;
+
+				texel& d = texels[cur][i];
+				d.depth = p.w;
+
+				uint8_t mark = valid ? refreshed_bit : 0;
+
+				if (valid && ((i + frame) & mask) != 0) {
+					const float rw = 1.f / p.z;
+
+					// the pixel whose center is nearest
+					const int px = floorf((p.x * rw + 1.f) * hw);
+					const int py = floorf((p.y * rw + 1.f) * hh);
+
+					mark = 0;
+
+					if (p.z < 0.f && px >= 0 && px < w && py >= 0 && py < h) {
+						const texel& s = texels[prev][offset(px, py)];
+
+						if (s.depth != 0.f && fabsf(s.depth - p.z) <= opts.depth_tolerance * fabsf(p.z)) {
+							const unsigned age = s.color[3] & age_bits;
+
+							if (age + 1 < opts.max_age) {
+								d.color = s.color;
+								d.color[3] = 255;
+
+								target[{o.x, o.y}] = d.color;
+
+								d.color[3] = age + 1;
+								return;
+							}
+
+							mark = refreshed_bit;
+						}
+					}
+				}
+
+				d.color[3] = mark;
+				sources[i] = {tri, o.b, o.c};
+			};
+		});
+
+		const DepthBuffer<F>& zbuf = pipe.depth_buffer();
+
+		stats s = {};
+
+		// shade what was not reused, only the nearest fragment is left
+		for (int t = 0; t < tw * th; ++t) {
+			const int x0 = t % tw * tilesize;
+			const int y0 = t / tw * tilesize;
+
+			covered[cur][t] = !zbuf.cleared(x0, y0);
+
+			if (!covered[cur][t])
+				continue;
+
+			texel* d = &texels[cur][t * tilesize * tilesize];
+			const source* src = &sources[t * tilesize * tilesize];
+
+			for (int k = 0; k < tilesize * tilesize; ++k) {
+				if (d[k].depth == 0.f)
+					continue;
+
+				++s.covered;
+
+				const uint8_t mark = d[k].color[3];
+
+				if (mark & age_bits) {
+					++s.reused;
+					continue;
+				}
+
+				if (mark & refreshed_bit)
+					++s.refreshed;
+				else
+					++s.disoccluded;
+
+				const Mesh::uint* tri = &mesh.inds[3 * src[k].tri];
+
+				d[k].color = shader.fragment(mix_varyings(
+					vout[tri[0]].var, vout[tri[1]].var, vout[tri[2]].var,
+					src[k].b, src[k].c));
+
+				target[{x0 + k % tilesize, y0 + k / tilesize}] = d[k].color;
+
+				d[k].color[3] = mark;
+			}
+		}
+
+		prev_cam = shader.cam;
+		valid = true;
+		++frame;
+
+		totals += s;
+		return s;
+	}
+};
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <new>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "linalg.hpp"
+#include "fbwriter.hpp"
+#include "jobs.hpp"
+#include "hugepages.hpp"
+
+using namespace std;
+
+/*
+ * Color target in 8x8 tiles, tiles row by row from the bottom, pixels in
+ * Morton order inside a tile: a 2x2 quad is 16 bytes and a 4x4 quadrant
+ * one cache line, so the rasterizer's small 2D walks stay within a few
+ * lines instead of touching a new row each step. The buffer sits on huge
+ * pages where the system allows. present() detiles, flips to top row
+ * first and writes linear rows for XWindow, Framebuffer or FBWriter.
+ */
+class TiledFramebuffer
+{
+public:
+	static constexpr int tilesize = 8;
+	static constexpr int tilepixels = tilesize * tilesize;
+
+private:
+	int w, h, tw, th;
+
+	HugePages memory;
+	bgracolor_t* pixels;
+
+	// Bits y2 x2 y1 x1 y0 x0 of the position within a tile; higher bits are ignored
+	static inline unsigned morton(unsigned x, unsigned y)
+	{
+		return (x & 1) | (y & 1) << 1 | (x & 2) << 1 | (y & 2) << 2 | (x & 4) << 2 | (y & 4) << 3;
+	}
+
+	// bgra to rgba is a swap of bytes 0 and 2 in each pixel
+	static inline uint32_t swap_rb(uint32_t p)
+	{
+		return (p & 0xff00ff00u) | (p >> 16 & 0xffu) | (p << 16 & 0xff0000u);
+	}
+
+	template<bool Swap>
+	inline void present_rows(int ty0, int ty1, uint32_t* dst) const
+	{
+		const uint32_t* src = reinterpret_cast<const uint32_t*>(pixels);
+
+		for (int ty = ty0; ty < ty1; ++ty)
+			for (int tx = 0; tx < tw; ++tx) {
+				const uint32_t* tile = src + static_cast<size_t>(ty * tw + tx) * tilepixels;
+
+				const int x0 = tx * tilesize;
+				const int y0 = ty * tilesize;
+
+				if (x0 + tilesize > w || y0 + tilesize > h) {
+					for (int y = y0; y < min(y0 + tilesize, h); ++y)
+						for (int x = x0; x < min(x0 + tilesize, w); ++x) {
+							const uint32_t p = tile[morton(x - x0, y - y0)];
+							dst[static_cast<size_t>(h - 1 - y) * w + x] = Swap ? swap_rb(p) : p;
+						}
+
+					continue;
+				}
+
+#ifdef __SSE2__
+				const __m128i mask = _mm_set1_epi32(0xff00ff00);
+				const __m128i byte = _mm_set1_epi32(0xff);
+
+				const auto convert = [&] (__m128i v)
+				{
+					if (!Swap)
+						return v;
+
+					return _mm_or_si128(_mm_and_si128(v, mask), _mm_or_si128(
+						_mm_and_si128(_mm_srli_epi32(v, 16), byte),
+						_mm_slli_epi32(_mm_and_si128(v, byte), 16)));
+				};
+
+				// a quadrant is four 2x2 quads; their halves are row pieces
+				for (int q = 0; q < 4; ++q) {
+					const __m128i* s = reinterpret_cast<const __m128i*>(tile + 16 * q);
+
+					const __m128i q0 = _mm_load_si128(s);
+					const __m128i q1 = _mm_load_si128(s + 1);
+					const __m128i q2 = _mm_load_si128(s + 2);
+					const __m128i q3 = _mm_load_si128(s + 3);
+
+					const int x = x0 + 4 * (q & 1);
+					const int y = y0 + 4 * (q >> 1);
+
+					uint32_t* row = dst + static_cast<size_t>(h - 1 - y) * w + x;
+
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(row),
+										convert(_mm_unpacklo_epi64(q0, q1)));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(row - w),
+										convert(_mm_unpackhi_epi64(q0, q1)));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(row - 2 * w),
+										convert(_mm_unpacklo_epi64(q2, q3)));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(row - 3 * w),
+										convert(_mm_unpackhi_epi64(q2, q3)));
+				}
+#else
+				for (int y = 0; y < tilesize; ++y) {
+					uint32_t* row = dst + static_cast<size_t>(h - 1 - y0 - y) * w + x0;
+
+					for (int x = 0; x < tilesize; ++x)
+						row[x] = Swap ? swap_rb(tile[morton(x, y)]) : tile[morton(x, y)];
+				}
+#endif
+			}
+	}
+
+	template<bool Swap>
+	inline void present_all(uint32_t* dst, JobSystem* jobs) const
+	{
+		if (jobs)
+			jobs->parallel_for(0, th, 4, [&] (size_t first, size_t last)
+			{
+				present_rows<Swap>(first, last, dst);
+			});
+		else
+			present_rows<Swap>(0, th, dst);
+	}
+
+public:
+	TiledFramebuffer(int width = 0, int height = 0) :
+		w(0), h(0), tw(0), th(0), pixels(nullptr)
+	{
+		resize(width, height);
+	}
+
+	inline void resize(int width, int height)
+	{
+		w = width;
+		h = height;
+
+		tw = (w + tilesize - 1) / tilesize;
+		th = (h + tilesize - 1) / tilesize;
+
+		const size_t count = static_cast<size_t>(tw) * th * tilepixels;
+
+		if (!memory.allocate(count * sizeof(bgracolor_t)))
+			throw bad_alloc();
+
+		pixels = static_cast<bgracolor_t*>(memory.data());
+		clear();
+	}
+
+	inline int width() const { return w; }
+	inline int height() const { return h; }
+
+	// Where the memory came from: hugetlb, thp or 4k
+	inline const char* backing() const
+	{
+		return memory.name();
+	}
+
+	inline void clear(const bgracolor_t& c = {0, 0, 0, 255})
+	{
+		fill(pixels, pixels + static_cast<size_t>(tw) * th * tilepixels, c);
+	}
+
+	inline size_t memory_usage() const
+	{
+		return memory.size();
+	}
+
+	inline size_t offset(int x, int y) const
+	{
+		const unsigned ux = x, uy = y;
+		const size_t t = static_cast<size_t>(uy / tilesize) * tw + ux / tilesize;
+
+		return t * tilepixels + morton(ux, uy);
+	}
+
+	inline bgracolor_t& operator[](const vec2i& coords)
+	{
+		assert(coords.x < w);
+		assert(coords.y < h);
+
+		return pixels[offset(coords.x, coords.y)];
+	}
+
+	inline const bgracolor_t& operator[](const vec2i& coords) const
+	{
+		assert(coords.x < w);
+		assert(coords.y < h);
+
+		return pixels[offset(coords.x, coords.y)];
+	}
+
+	// Linear rows of width() pixels, top row first, as in XWindow::data()
+	inline void present(bgracolor_t* dst, JobSystem* jobs = nullptr) const
+	{
+		present_all<false>(reinterpret_cast<uint32_t*>(dst), jobs);
+	}
+
+	// Same into the writer's rgba buffer, which must be as large
+	inline void present(FBWriter& writer, JobSystem* jobs = nullptr) const
+	{
+		assert(writer.resolution.w == w && writer.resolution.h == h);
+
+		present_all<true>(reinterpret_cast<uint32_t*>(writer.data()), jobs);
+	}
+};
@@ -0,0 +1,130 @@
+#include <iostream>
+#include <memory>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+
+#include "stream.hpp"
+#include "xwindow.hpp"
+#include "dynres.hpp"
+#include "fbwriter.hpp"
+
+/*
+ * Reference viewer for rast --stream: decodes the tile stream and shows
+ * it, scaled to the window, or only decodes with --headless. --out keeps
+ * the last frame as raw rgba, --frames stops after that many.
+ */
+struct Options
+{
+	const char* address = nullptr;
+	const char* out = nullptr;
+	unsigned frames = 0;
+	bool headless = false;
+};
+
+static Options parse_options(int argc, char** argv)
+{
+	Options opts;
+
+	for (int i = 1; i < argc; ++i) {
+		const bool has_value = i + 1 < argc;
+
+		if (!strcmp(argv[i], "--frames") && has_value)
+			opts.frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--out") && has_value)
+			opts.out = argv[++i];
+		else if (!strcmp(argv[i], "--headless"))
+			opts.headless = true;
+		else if (argv[i][0] != '-' && !opts.address)
+			opts.address = argv[i];
+		else
+			throw std::invalid_argument("unknown option " + std::string(argv[i]));
+	}
+
+	if (!opts.address)
+		throw std::invalid_argument("usage: viewer unix:PATH|tcp:[HOST:]PORT "
+									"[--frames N] [--out FILE] [--headless]");
+
+	return opts;
+}
+
+static bool write_frame(const TileDecoder& dec, const char* filename)
+{
+	FBWriter writer({static_cast<uint16_t>(dec.width()), static_cast<uint16_t>(dec.height())});
+
+	const bgracolor_t* src = dec.data();
+	rgbacolor_t* dst = writer.data();
+
+	for (int i = 0; i < dec.width() * dec.height(); ++i)
+		dst[i] = {src[i].r, src[i].g, src[i].b, src[i].a};
+
+	writer.open(filename);
+	if (!writer.is_open())
+		return false;
+
+	writer.flush();
+	return true;
+}
+
+int main(int argc, char** argv) {
+	using clock = chrono::steady_clock;
+
+	const Options opts = parse_options(argc, argv);
+
+	const int fd = stream_connect(opts.address);
+
+	std::unique_ptr<XWindow> xw;
+	if (!opts.headless)
+		xw.reset(new XWindow);
+
+	TileDecoder dec;
+	Upscaler upscale;
+
+	stream_header hdr;
+
+	unsigned frames = 0;
+	size_t bytes = 0;
+	size_t tiles = 0;
+
+	clock::time_point last = clock::now();
+
+	// ends on a closed stream as well as on one that does not decode
+	while ((!opts.frames || frames < opts.frames) && dec.read(fd, hdr)) {
+		++frames;
+		bytes += sizeof(hdr) + hdr.bytes;
+		tiles += hdr.tiles;
+
+		if (xw) {
+			if (dec.width() == xw->width() && dec.height() == xw->height())
+				memcpy(xw->data(), dec.data(), dec.width() * dec.height() * sizeof(bgracolor_t));
+			else
+				upscale.resample(dec.data(), dec.width(), dec.height(),
+									xw->data(), xw->width(), xw->height());
+
+			xw->update();
+		}
+
+		if (frames % 100 == 0) {
+			const clock::time_point now = clock::now();
+			const double seconds = chrono::duration<double>(now - last).count();
+			last = now;
+
+			cerr << "viewer: " << dec.width() << "x" << dec.height() << ", "
+				<< 100. / seconds << " fps, " << bytes / 100 / 1024 << " KiB and "
+				<< tiles / 100 << " tiles per frame, " << 8e-6 * bytes / seconds << " Mbit/s" << endl;
+
+			bytes = tiles = 0;
+		}
+	}
+
+	close(fd);
+
+	if (opts.out && frames && !write_frame(dec, opts.out)) {
+		cerr << "viewer: can not write " << opts.out << endl;
+		return 1;
+	}
+
+	cerr << "viewer: " << frames << " frames" << endl;
+
+	return 0;
+}
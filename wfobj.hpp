@@ -1,8 +1,10 @@
 #pragma once
 #include <cstdio>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include "linalg.hpp"
+#include "jobs.hpp"
 
 struct Mesh
 {
@@ -18,60 +20,157 @@ struct Mesh
     std::vector<uint> inds;
 };
 
-inline Mesh import_obj(char const *filename)
+// Attributes and faces of a run of whole lines of an .obj file
+struct ObjChunk
 {
-    std::ifstream in(filename);
-    Mesh out;
-    if(!in.is_open())
-        throw std::invalid_argument("can not find file " + std::string(filename));
-
     std::vector<vec3f> pos;
     std::vector<vec2f> tex;
     std::vector<vec3f> norm;
 
+    std::vector<Mesh::uint> corners;    // v/vt/vn index triplets
+    std::vector<Mesh::uint> faces;      // corner count of every face
+
+    size_t verts = 0;
+    size_t inds = 0;
+};
+
+inline void parse_obj_chunk(char const *begin, char const *end, ObjChunk& out)
+{
     std::string line;
-    while(std::getline(in, line))
+    while(begin < end)
     {
+        char const *eol = std::find(begin, end, '\n');
+        line.assign(begin, eol);
+        begin = eol + 1;
+
         char const * const cstr = line.c_str();
-        
+
         if(cstr[0] == 'v')
         {
             vec3f v;
             vec2f vt;
             if(sscanf(cstr + 1, " %f %f %f", &v.x, &v.y, &v.z) == 3)
-                pos.push_back(v);
+                out.pos.push_back(v);
             else if(sscanf(cstr + 1, "t %f %f", &vt.x, &vt.y) == 2)
-                tex.push_back(vt);
+                out.tex.push_back(vt);
             else if(sscanf(cstr + 1, "n %f %f %f", &v.x, &v.y, &v.z) == 3)
-                norm.push_back(v);
+                out.norm.push_back(v);
         }
         else if(cstr[0] == 'f')
-        {	
+        {
             Mesh::uint idx[3];
-            auto const vsize = out.verts.size();
+            Mesh::uint vcount = 0;
 
             char const *cptr = cstr + 2;
             int eaten;
             while(sscanf(cptr, "%u/%u/%u%n", idx, idx + 1, idx + 2, &eaten) == 3)
             {
-                out.verts.push_back({pos[idx[0] - 1], tex[idx[1] - 1], norm[idx[2] - 1]});
+                out.corners.insert(out.corners.end(), idx, idx + 3);
                 cptr += eaten;
+                vcount++;
             }
 
-            auto const vcount = out.verts.size() - vsize;
-            
             if (!vcount) continue;
-            
-            for(auto i = 1u; i < vcount - 1; i++)
+
+            out.faces.push_back(vcount);
+            out.verts += vcount;
+            out.inds += vcount > 2 ? 3 * (vcount - 2) : 0;
+        }
+    }
+}
+
+/*
+ * With a job system the file is split into line-aligned chunks that are
+ * parsed in parallel, then the chunks' faces are expanded in parallel
+ * into their slice of the vertex and index arrays.
+ */
+inline Mesh import_obj(char const *filename, JobSystem *jobs = nullptr)
+{
+    std::ifstream in(filename, std::ios::binary);
+    Mesh out;
+    if(!in.is_open())
+        throw std::invalid_argument("can not find file " + std::string(filename));
+
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string const text = buffer.str();
+
+    size_t const nchunks = jobs ? 4 * (jobs->threads() + 1) : 1;
+
+    std::vector<char const *> bounds = {text.data()};
+    for(size_t i = 1; i < nchunks; i++)
+    {
+        size_t const at = std::max<size_t>(text.size() * i / nchunks,
+                                            bounds.back() - text.data());
+        size_t const eol = text.find('\n', at);
+        bounds.push_back(eol == std::string::npos ?
+                            text.data() + text.size() : text.data() + eol + 1);
+    }
+    bounds.push_back(text.data() + text.size());
+
+    std::vector<ObjChunk> chunks(nchunks);
+
+    auto const parse = [&](size_t first, size_t last)
+    {
+        for(size_t c = first; c < last; c++)
+            parse_obj_chunk(bounds[c], bounds[c + 1], chunks[c]);
+    };
+
+    if(jobs)
+        jobs->parallel_for(0, nchunks, 1, parse);
+    else
+        parse(0, nchunks);
+
+    // face indices are global, so the attribute arrays are simply joined
+    std::vector<vec3f> pos;
+    std::vector<vec2f> tex;
+    std::vector<vec3f> norm;
+
+    std::vector<size_t> vbase(nchunks + 1, 0), ibase(nchunks + 1, 0);
+    for(size_t c = 0; c < nchunks; c++)
+    {
+        pos.insert(pos.end(), chunks[c].pos.begin(), chunks[c].pos.end());
+        tex.insert(tex.end(), chunks[c].tex.begin(), chunks[c].tex.end());
+        norm.insert(norm.end(), chunks[c].norm.begin(), chunks[c].norm.end());
+
+        vbase[c + 1] = vbase[c] + chunks[c].verts;
+        ibase[c + 1] = ibase[c] + chunks[c].inds;
+    }
+
+    out.verts.resize(vbase[nchunks]);
+    out.inds.resize(ibase[nchunks]);
+
+    auto const expand = [&](size_t first, size_t last)
+    {
+        for(size_t c = first; c < last; c++)
+        {
+            ObjChunk const &chunk = chunks[c];
+
+            Mesh::uint const *idx = chunk.corners.data();
+            size_t v = vbase[c];
+            size_t i = ibase[c];
+
+            for(Mesh::uint const vcount: chunk.faces)
             {
-                out.inds.push_back(vsize);
-                out.inds.push_back(vsize + i);
-                out.inds.push_back(vsize + i + 1);
+                auto const vsize = v;
+
+                for(auto k = 0u; k < vcount; k++, idx += 3)
+                    out.verts[v++] = {pos[idx[0] - 1], tex[idx[1] - 1], norm[idx[2] - 1]};
+
+                for(auto k = 1u; k + 1 < vcount; k++)
+                {
+                    out.inds[i++] = vsize;
+                    out.inds[i++] = vsize + k;
+                    out.inds[i++] = vsize + k + 1;
+                }
             }
         }
-    }
-    
-    //std::cout << "here 2" << std::endl;
-    
+    };
+
+    if(jobs)
+        jobs->parallel_for(0, nchunks, 1, expand);
+    else
+        expand(0, nchunks);
+
     return out;
 }
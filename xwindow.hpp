@@ -31,6 +31,7 @@ public:
     void clear() noexcept;
     
     bgracolor_t& operator[](const vec2i& coords);
+    bgracolor_t* data() noexcept;
 
 private:
     Display *display;
@@ -81,6 +82,11 @@ inline void     XWindow::update() noexcept
     );
 }
 
+inline bgracolor_t* XWindow::data() noexcept
+{
+    return pixels;
+}
+
 bgracolor_t& XWindow::operator[](const vec2i& coords)
 {
     assert(coords.x < res.w);